@@ -0,0 +1,290 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Bvh.h"
+#include "Geometry.h"
+#include "MappedFile.h"
+#include "OccupancyMap.h"
+#include "WideBvh.h"
+
+// Built accelerators kept on disk between runs: the BVH, the wide BVH and
+// the occupancy map of a scene go into one file in a directory, named by a
+// hash of the scene's circles and the builder. A later run with the same
+// circles maps the file and copies each structure's arrays out of it as
+// they are, with nothing to parse or rebuild. The file is a header followed
+// by the arrays at 64-byte aligned offsets, in this build's own layout;
+// the layout goes into the hash, so a build with another layout never
+// picks the file up.
+class AcceleratorCache {
+public:
+    // Bump when a builder changes the trees it makes, so older files stop
+    // matching.
+    static const uint32_t Version = 2;
+
+    enum class Result { Loaded, Saved, NotSaved };
+
+    explicit AcceleratorCache(std::string directory) : directory(std::move(directory)) {}
+
+    static uint64_t key(const std::vector<Circle>& circles, BvhBuilder builder) {
+        const uint64_t layout[] = { Version, static_cast<uint64_t>(builder), sizeof(BvhNode), sizeof(BvhProxy),
+            sizeof(Circle), sizeof(WideBvhNode), Bvh::maxLeafSize, OccupancyMap::MaxResolution };
+        uint64_t h = hash(layout, sizeof(layout), 0x5352544143434c31ull);
+        return hash(circles.data(), circles.size() * sizeof(Circle), h);
+    }
+
+    std::string pathFor(uint64_t key) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llx.srtaccel", static_cast<unsigned long long>(key));
+        if (directory.empty()) return name;
+        char last = directory.back();
+        return last == '/' || last == '\\' ? directory + name : directory + "/" + name;
+    }
+
+    // Replaces bvh, wide and occupancy with the ones saved for circles and
+    // builder. False, leaving them as they were, if there is no such file,
+    // it is cut short, or what it holds is not trees and a map that can be
+    // traced without reading out of bounds.
+    bool load(const std::vector<Circle>& circles, BvhBuilder builder, Bvh& bvh, WideBvh& wide,
+        OccupancyMap& occupancy) const {
+        uint64_t sceneKey = key(circles, builder);
+        MappedFile file = MappedFile::open(pathFor(sceneKey).c_str());
+        if (!file.valid() || file.getSize() < sizeof(Header)) return false;
+        const uint8_t* base = static_cast<const uint8_t*>(file.get());
+        size_t size = file.getSize();
+        Header header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, magic(), sizeof(header.magic)) != 0 || header.key != sceneKey
+            || header.circleCount != circles.size()) return false;
+
+        Bvh loadedBvh;
+        WideBvh loadedWide;
+        OccupancyMap loadedOccupancy;
+        if (!copy(base, size, header.sections[BvhNodes], loadedBvh.nodes)
+            || !copy(base, size, header.sections[BvhProxies], loadedBvh.proxies)
+            || !copy(base, size, header.sections[Primitives], loadedBvh.primitives)
+            || !copy(base, size, header.sections[WideNodes], loadedWide.nodes)
+            || !copy(base, size, header.sections[WideProxies], loadedWide.proxies)
+            || !copy(base, size, header.sections[OccupancyExact], loadedOccupancy.exact)
+            || !copy(base, size, header.sections[OccupancyDilated], loadedOccupancy.dilated)) return false;
+        loadedWide.primitives = loadedBvh.primitives;
+        loadedOccupancy.width = header.occupancyWidth;
+        loadedOccupancy.height = header.occupancyHeight;
+        loadedOccupancy.gridMin = Vec2(header.gridMinX, header.gridMinY);
+        loadedOccupancy.cellSize = header.cellSize;
+        loadedOccupancy.invCellSize = header.invCellSize;
+        loadedOccupancy.fraction = header.occupiedFraction;
+        loadedOccupancy.active = header.occupancyActive != 0;
+        if (loadedBvh.primitives.size() != circles.size() || !valid(loadedBvh) || !valid(loadedWide)
+            || !valid(loadedOccupancy)) return false;
+
+        bvh = std::move(loadedBvh);
+        wide = std::move(loadedWide);
+        occupancy = std::move(loadedOccupancy);
+        return true;
+    }
+
+    // Writes the file for circles and builder. It is written under a
+    // temporary name and renamed into place, so a run that stops halfway
+    // leaves no file that load() would take.
+    bool save(const std::vector<Circle>& circles, BvhBuilder builder, const Bvh& bvh, const WideBvh& wide,
+        const OccupancyMap& occupancy) const {
+        Header header = {};
+        std::memcpy(header.magic, magic(), sizeof(header.magic));
+        header.key = key(circles, builder);
+        header.circleCount = circles.size();
+        header.occupancyWidth = occupancy.width;
+        header.occupancyHeight = occupancy.height;
+        header.gridMinX = occupancy.gridMin.x;
+        header.gridMinY = occupancy.gridMin.y;
+        header.cellSize = occupancy.cellSize;
+        header.invCellSize = occupancy.invCellSize;
+        header.occupiedFraction = occupancy.fraction;
+        header.occupancyActive = occupancy.active;
+
+        const void* arrays[SectionCount] = { bvh.nodes.data(), bvh.proxies.data(), bvh.primitives.data(),
+            wide.nodes.data(), wide.proxies.data(), occupancy.exact.data(), occupancy.dilated.data() };
+        const uint64_t bytes[SectionCount] = { bytesOf(bvh.nodes), bytesOf(bvh.proxies), bytesOf(bvh.primitives),
+            bytesOf(wide.nodes), bytesOf(wide.proxies), bytesOf(occupancy.exact), bytesOf(occupancy.dilated) };
+        uint64_t offset = aligned(sizeof(Header));
+        for (int s = 0; s < SectionCount; ++s) {
+            header.sections[s].offset = offset;
+            header.sections[s].bytes = bytes[s];
+            offset = aligned(offset + bytes[s]);
+        }
+
+        std::string path = pathFor(header.key);
+        std::string temporary = path + ".tmp";
+        FILE* file = std::fopen(temporary.c_str(), "wb");
+        if (!file) return false;
+        static const char padding[Alignment] = {};
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1;
+        uint64_t written = sizeof(header);
+        for (int s = 0; s < SectionCount && ok; ++s) {
+            size_t pad = static_cast<size_t>(header.sections[s].offset - written);
+            ok = std::fwrite(padding, 1, pad, file) == pad
+                && std::fwrite(arrays[s], 1, static_cast<size_t>(bytes[s]), file) == bytes[s];
+            written = header.sections[s].offset + bytes[s];
+        }
+        ok = std::fclose(file) == 0 && ok;
+        // Another run may have saved the same file meanwhile; either is fine.
+        if (ok && std::rename(temporary.c_str(), path.c_str()) == 0) return true;
+        std::remove(temporary.c_str());
+        return ok && MappedFile::open(path.c_str()).valid();
+    }
+
+private:
+    static const size_t Alignment = 64;
+    static const char* magic() { return "SRTACCEL"; }
+
+    enum Section { BvhNodes, BvhProxies, Primitives, WideNodes, WideProxies, OccupancyExact, OccupancyDilated, SectionCount };
+
+    struct Span {
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    struct Header {
+        char magic[8];
+        uint64_t key;
+        uint64_t circleCount;
+        int32_t occupancyWidth, occupancyHeight;
+        float gridMinX, gridMinY, cellSize, invCellSize, occupiedFraction;
+        uint32_t occupancyActive;
+        Span sections[SectionCount];
+    };
+
+    static uint64_t aligned(uint64_t offset) { return (offset + Alignment - 1) / Alignment * Alignment; }
+
+    template <typename T>
+    static uint64_t bytesOf(const std::vector<T>& array) { return array.size() * sizeof(T); }
+
+    // Fills array from a section, checking that the section lies within
+    // the file.
+    template <typename T>
+    static bool copy(const uint8_t* base, size_t size, const Span& section, std::vector<T>& array) {
+        static_assert(std::is_trivially_copyable<T>::value, "sections hold arrays as they are in memory");
+        if (section.offset > size || section.bytes > size - section.offset || section.bytes % sizeof(T) != 0) return false;
+        const T* first = reinterpret_cast<const T*>(base + section.offset);
+        array.assign(first, first + section.bytes / sizeof(T));
+        return true;
+    }
+
+    // A loaded tree must stay within Bvh::MaxDepth, the depth both
+    // traversal stacks are sized for and the builders stop at.
+    static const int MaxEmptyLevel = 16;
+
+    // Every node is reached from the root exactly once, no deeper than
+    // traversal can go, with leaves inside primitives and an inner node's
+    // two children after it in nodes.
+    static bool valid(const Bvh& bvh) {
+        const std::vector<BvhNode>& nodes = bvh.nodes;
+        int64_t primitives = static_cast<int64_t>(bvh.primitives.size());
+        if (primitives == 0) return true;
+        if (nodes.empty() || bvh.proxies.size() != nodes.size()) return false;
+        int64_t nodeCount = static_cast<int64_t>(nodes.size());
+        std::vector<uint8_t> seen(nodes.size(), 0);
+        std::vector<std::pair<int32_t, int>> todo(1, std::make_pair(0, 0));
+        size_t visited = 0;
+        while (!todo.empty()) {
+            std::pair<int32_t, int> next = todo.back();
+            todo.pop_back();
+            if (seen[next.first]++) return false;
+            ++visited;
+            const BvhNode& node = nodes[next.first];
+            if (node.count > 0) {
+                if (node.count > Bvh::maxLeafSize || node.first < 0 || node.first > primitives - node.count) return false;
+                continue;
+            }
+            if (node.count < 0 || node.first <= next.first || node.first + int64_t(1) >= nodeCount
+                || next.second >= Bvh::MaxDepth) return false;
+            todo.push_back(std::make_pair(node.first, next.second + 1));
+            todo.push_back(std::make_pair(node.first + 1, next.second + 1));
+        }
+        return visited == nodes.size();
+    }
+
+    // As above, for each slot of the wide nodes: unused slots keep the
+    // bounds no ray reaches, leaves lie inside primitives and inner
+    // children come after their node.
+    static bool valid(const WideBvh& wide) {
+        const std::vector<WideBvhNode>& nodes = wide.nodes;
+        int64_t primitives = static_cast<int64_t>(wide.primitives.size());
+        if (primitives == 0) return nodes.empty() && wide.proxies.empty();
+        if (nodes.empty() || wide.proxies.size() != nodes.size() * WideBvh::Width) return false;
+        int64_t nodeCount = static_cast<int64_t>(nodes.size());
+        std::vector<uint8_t> seen(nodes.size(), 0);
+        std::vector<std::pair<int32_t, int>> todo(1, std::make_pair(0, 0));
+        size_t visited = 0;
+        while (!todo.empty()) {
+            std::pair<int32_t, int> next = todo.back();
+            todo.pop_back();
+            if (seen[next.first]++) return false;
+            ++visited;
+            const WideBvhNode& node = nodes[next.first];
+            for (int s = 0; s < WideBvh::Width; ++s) {
+                int32_t first = node.links[s];
+                int32_t count = node.counts[s];
+                if (count == -1) {
+                    if (node.minX[s] != 1e30f || node.minY[s] != 1e30f || node.maxX[s] != 1e30f || node.maxY[s] != 1e30f) return false;
+                }
+                else if (count > 0) {
+                    if (count > Bvh::maxLeafSize || first < 0 || first > primitives - count) return false;
+                }
+                else if (count < 0 || first <= next.first || first >= nodeCount || next.second >= Bvh::MaxDepth) {
+                    return false;
+                }
+                else {
+                    todo.push_back(std::make_pair(first, next.second + 1));
+                }
+            }
+        }
+        return visited == nodes.size();
+    }
+
+    // Both maps cover the grid, every cell is occupied or an empty block
+    // level the walk can shift by (a 2048-cell grid has 12), and the walk
+    // has a cell size to step by.
+    static bool valid(const OccupancyMap& map) {
+        if (map.width < 0 || map.height < 0) return false;
+        uint64_t cells = static_cast<uint64_t>(map.width) * static_cast<uint64_t>(map.height);
+        if (map.exact.size() != cells || map.dilated.size() != cells) return false;
+        if (!map.active) return true;
+        if (cells == 0 || !(map.cellSize > 0.0f) || !(map.invCellSize > 0.0f) || !std::isfinite(map.invCellSize)
+            || !std::isfinite(map.gridMin.x) || !std::isfinite(map.gridMin.y)) return false;
+        for (size_t i = 0; i < cells; ++i) {
+            if ((map.exact[i] >= MaxEmptyLevel && map.exact[i] != OccupancyMap::Occupied)
+                || (map.dilated[i] >= MaxEmptyLevel && map.dilated[i] != OccupancyMap::Occupied)) return false;
+        }
+        return true;
+    }
+
+    // Eight bytes at a time, each word multiplied in and folded down; the
+    // tail is zero-padded and the length mixed in last.
+    static uint64_t hash(const void* data, size_t size, uint64_t h) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        size_t words = size / 8;
+        for (size_t i = 0; i < words; ++i) {
+            uint64_t word;
+            std::memcpy(&word, bytes + i * 8, 8);
+            h = mix(h ^ word);
+        }
+        uint64_t tail = 0;
+        if (size > words * 8) std::memcpy(&tail, bytes + words * 8, size - words * 8);
+        return mix(mix(h ^ tail) ^ size);
+    }
+
+    static uint64_t mix(uint64_t h) {
+        h *= 0xff51afd7ed558ccdull;
+        return h ^ h >> 32;
+    }
+
+    std::string directory;
+};
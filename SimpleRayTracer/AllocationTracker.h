@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+enum class FrameStage {
+    Events,
+    Trace,
+    Draw,
+    Present,
+    Count
+};
+
+inline const char* frameStageName(FrameStage stage) {
+    switch (stage) {
+    case FrameStage::Events: return "events";
+    case FrameStage::Trace: return "trace";
+    case FrameStage::Draw: return "draw";
+    case FrameStage::Present: return "present";
+    default: return "?";
+    }
+}
+
+struct FrameAllocations {
+    uint64_t count[static_cast<int>(FrameStage::Count)];
+    uint64_t bytes[static_cast<int>(FrameStage::Count)];
+
+    uint64_t totalCount() const {
+        uint64_t n = 0;
+        for (uint64_t c : count) n += c;
+        return n;
+    }
+};
+
+// Counts heap allocations per render loop stage. The global operator new
+// replacement in SRT_PROFILE builds reports into recordAllocation(); the
+// frame loop tags stages with setStage() and collects with endFrame().
+class AllocationTracker {
+public:
+    static void setStage(FrameStage stage) {
+        state().stage.store(static_cast<int>(stage), std::memory_order_relaxed);
+    }
+
+    static void recordAllocation(size_t bytes) {
+        State& s = state();
+        int stage = s.stage.load(std::memory_order_relaxed);
+        s.count[stage].fetch_add(1, std::memory_order_relaxed);
+        s.bytes[stage].fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    static FrameAllocations endFrame() {
+        State& s = state();
+        FrameAllocations result;
+        for (int i = 0; i < static_cast<int>(FrameStage::Count); ++i) {
+            result.count[i] = s.count[i].exchange(0, std::memory_order_relaxed);
+            result.bytes[i] = s.bytes[i].exchange(0, std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+private:
+    struct State {
+        std::atomic<int> stage;
+        std::atomic<uint64_t> count[static_cast<int>(FrameStage::Count)];
+        std::atomic<uint64_t> bytes[static_cast<int>(FrameStage::Count)];
+    };
+
+    // Zero-initialised static storage, so it is usable by allocations that
+    // happen before main() or during static initialisation of other objects.
+    static State& state() {
+        static State s;
+        return s;
+    }
+};
@@ -0,0 +1,549 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Geometry.h"
+#include "ThreadPool.h"
+
+struct BvhNode {
+    Aabb bounds;
+    // Leaves: first primitive and primitive count. Inner nodes: index of the
+    // left child (the right child follows it) and a count of zero.
+    int32_t first;
+    int32_t count;
+
+    bool isLeaf() const { return count > 0; }
+};
+
+// Stand-in for everything below a node: one circle at the area-weighted
+// centroid with the combined area of the members, and the node's largest
+// extent as the geometric error of using it.
+struct BvhProxy {
+    Circle shape;
+    float size;
+};
+
+// A subtree is replaced by its proxy once its error is at most
+// maxErrorPixels on screen.
+struct LodSettings {
+    float pixelsPerUnit;
+    float maxErrorPixels;
+
+    bool accepts(const BvhProxy& proxy) const {
+        return proxy.size * pixelsPerUnit <= maxErrorPixels;
+    }
+};
+
+// How a Bvh chooses its splits, from best trees to fastest builds.
+enum class BvhBuilder {
+    // Surface area heuristic (perimeter, in 2D) evaluated at 16 bin
+    // boundaries along each axis of the centroids.
+    BinnedSah,
+    // Median split on the longest axis of the centroids.
+    Median,
+    // Primitives sorted along a Morton curve once, then split where the
+    // highest bit in which a node's codes differ changes.
+    Lbvh
+};
+
+// Binary bounding volume hierarchy over circles, built top-down. Primitives
+// are copied into leaf order so a leaf is a contiguous run of circles, and
+// children always come after their parent in the node array.
+class Bvh {
+public:
+    // Largest leaf any builder makes.
+    static const int maxLeafSize = 4;
+    // Traversal keeps pending nodes on a StackSize-entry stack, and a node
+    // at depth d leaves at most d + 2 entries on it once its children are
+    // pushed, so no builder makes a leaf deeper than MaxDepth.
+    static const int StackSize = 64;
+    static const int MaxDepth = StackSize - 2;
+
+    // With a pool, the top levels are split on the calling thread, with
+    // the passes over big nodes spread over the pool, until every thread can
+    // take a few subtrees; the subtrees are then built in parallel and
+    // spliced in. The tree is the same with or without a pool.
+    void build(const std::vector<Circle>& circles, BvhBuilder builder = BvhBuilder::Lbvh, ThreadPool* pool = nullptr) {
+        nodes.clear();
+        proxies.clear();
+        if (circles.empty()) {
+            primitives.clear();
+            nodes.push_back(BvhNode{ Aabb(), 0, 0 });
+            return;
+        }
+        std::vector<uint32_t> codes;
+        if (builder == BvhBuilder::Lbvh) sortAlongMortonCurve(circles, codes, pool);
+        else primitives = circles;
+        // Until buildBoundsAndProxies(), a node's bounds are those of its
+        // primitives' centroids.
+        nodes.push_back(BvhNode{ centroidBounds(0, static_cast<int>(primitives.size()), pool), 0, static_cast<int32_t>(primitives.size()) });
+
+        std::vector<int> subtrees(1, 0);
+        size_t wanted = pool && pool->size() > 1 ? 4 * static_cast<size_t>(pool->size()) : 1;
+        int depth = 0;
+        while (subtrees.size() < wanted) {
+            std::vector<int> next;
+            for (int index : subtrees) {
+                if (!split(builder, codes, nodes, index, depth, pool)) continue;
+                next.push_back(nodes[index].first);
+                next.push_back(nodes[index].first + 1);
+            }
+            if (next.empty()) break;
+            subtrees.swap(next);
+            ++depth;
+        }
+
+        std::vector<std::vector<BvhNode>> built(subtrees.size());
+        parallel(pool, static_cast<int>(subtrees.size()), [&](int s) {
+            std::vector<BvhNode>& local = built[s];
+            local.reserve(nodes[subtrees[s]].count);
+            local.push_back(nodes[subtrees[s]]);
+            std::vector<std::pair<int, int>> todo(1, std::make_pair(0, depth));
+            while (!todo.empty()) {
+                std::pair<int, int> next = todo.back();
+                todo.pop_back();
+                if (!split(builder, codes, local, next.first, next.second, nullptr)) continue;
+                todo.push_back(std::make_pair(local[next.first].first, next.second + 1));
+                todo.push_back(std::make_pair(local[next.first].first + 1, next.second + 1));
+            }
+        });
+
+        // Each subtree's root replaces its placeholder among the top nodes;
+        // the rest go after them, in subtree order.
+        size_t top = nodes.size();
+        std::vector<size_t> offsets(subtrees.size());
+        if (subtrees.size() == 1 && subtrees[0] == 0) {
+            nodes.swap(built[0]);
+            top = nodes.size();
+            subtrees.clear();
+        }
+        else {
+            size_t total = top;
+            for (size_t s = 0; s < subtrees.size(); ++s) {
+                offsets[s] = total;
+                total += built[s].size() - 1;
+            }
+            nodes.resize(total);
+            parallel(pool, static_cast<int>(subtrees.size()), [&](int s) {
+                const std::vector<BvhNode>& local = built[s];
+                for (size_t i = 0; i < local.size(); ++i) {
+                    BvhNode node = local[i];
+                    if (!node.isLeaf()) node.first = static_cast<int32_t>(offsets[s] + node.first - 1);
+                    nodes[i == 0 ? subtrees[s] : offsets[s] + i - 1] = node;
+                }
+            });
+        }
+
+        proxies.assign(nodes.size(), BvhProxy());
+        std::vector<float> areas(nodes.size());
+        parallel(pool, static_cast<int>(subtrees.size()), [&](int s) {
+            buildBoundsAndProxies(offsets[s], offsets[s] + built[s].size() - 1, areas);
+        });
+        buildBoundsAndProxies(0, top, areas);
+    }
+
+    bool empty() const { return primitives.empty(); }
+    const std::vector<BvhNode>& getNodes() const { return nodes; }
+
+    // Depth of the deepest leaf; the root is at depth 0.
+    int depth() const {
+        if (primitives.empty()) return 0;
+        int deepest = 0;
+        std::vector<std::pair<int, int>> todo(1, std::make_pair(0, 0));
+        while (!todo.empty()) {
+            std::pair<int, int> next = todo.back();
+            todo.pop_back();
+            const BvhNode& node = nodes[next.first];
+            deepest = std::max(deepest, next.second);
+            if (node.isLeaf()) continue;
+            todo.push_back(std::make_pair(node.first, next.second + 1));
+            todo.push_back(std::make_pair(node.first + 1, next.second + 1));
+        }
+        return deepest;
+    }
+    const std::vector<Circle>& getPrimitives() const { return primitives; }
+    const std::vector<BvhProxy>& getProxies() const { return proxies; }
+
+    // Expected box and circle tests for a ray through the root's bounds,
+    // by the surface area heuristic with both costing the same.
+    float expectedCost() const {
+        if (primitives.empty()) return 0.0f;
+        double sum = 0.0;
+        for (const BvhNode& node : nodes) sum += node.bounds.perimeter() * (node.isLeaf() ? node.count : 1);
+        return static_cast<float>(sum / nodes[0].bounds.perimeter());
+    }
+
+    // Closest hit along origin + dir * t for t in (0, tMax]. With lod set,
+    // subtrees below the error threshold are hit-tested as their proxy.
+    bool intersect(const Vec2& origin, const Vec2& dir, float tMax, float& tHit,
+        const LodSettings* lod = nullptr) const {
+        if (primitives.empty()) return false;
+        Vec2 invDir(1.0f / dir.x, 1.0f / dir.y);
+        int stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+        bool hit = false;
+        tHit = tMax;
+
+        while (top > 0) {
+            int index = stack[--top];
+            const BvhNode& node = nodes[index];
+            float tEntry;
+            if (!intersectAabb(node.bounds, origin, invDir, tHit, tEntry)) continue;
+
+            if (lod && node.count != 1 && lod->accepts(proxies[index])) {
+                float t;
+                if (intersectCircle(proxies[index].shape, origin, dir, t) && t < tHit) {
+                    tHit = t;
+                    hit = true;
+                }
+                continue;
+            }
+
+            if (node.isLeaf()) {
+                for (int i = node.first; i < node.first + node.count; ++i) {
+                    float t;
+                    if (intersectCircle(primitives[i], origin, dir, t) && t < tHit) {
+                        tHit = t;
+                        hit = true;
+                    }
+                }
+                continue;
+            }
+
+            // Visit the nearer child first so tHit shrinks early.
+            int left = node.first;
+            int right = node.first + 1;
+            float tLeft, tRight;
+            bool hitLeft = intersectAabb(nodes[left].bounds, origin, invDir, tHit, tLeft);
+            bool hitRight = intersectAabb(nodes[right].bounds, origin, invDir, tHit, tRight);
+            if (hitLeft && hitRight) {
+                if (tLeft < tRight) std::swap(left, right);
+                stack[top++] = left;
+                stack[top++] = right;
+            }
+            else if (hitLeft) stack[top++] = left;
+            else if (hitRight) stack[top++] = right;
+        }
+        return hit;
+    }
+
+    // Calls visit(circle) for every circle whose bounds overlap box. With lod
+    // set, subtrees below the error threshold are visited as their proxy.
+    template <typename Visit>
+    void query(const Aabb& box, Visit&& visit, const LodSettings* lod = nullptr) const {
+        if (primitives.empty()) return;
+        int stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0) {
+            int index = stack[--top];
+            const BvhNode& node = nodes[index];
+            if (!node.bounds.overlaps(box)) continue;
+            if (lod && node.count != 1 && lod->accepts(proxies[index])) {
+                visit(proxies[index].shape);
+                continue;
+            }
+            if (node.isLeaf()) {
+                for (int i = node.first; i < node.first + node.count; ++i) {
+                    if (boundsOf(primitives[i]).overlaps(box)) visit(primitives[i]);
+                }
+                continue;
+            }
+            stack[top++] = node.first;
+            stack[top++] = node.first + 1;
+        }
+    }
+
+private:
+    friend class AcceleratorCache;
+
+    static const int sahBins = 16;
+    // Below this depth binned SAH and LBVH fall back to median splits. Each
+    // of those halves what is left, so even 2^31 primitives end in leaves
+    // of maxLeafSize by depth 61, within MaxDepth, however skewed the scene.
+    static const int maxHeuristicDepth = 32;
+    // Primitives per chunk when one pass is spread over a pool.
+    static const int parallelGrain = 1 << 16;
+    // Most chunks one pass is split into.
+    static const int maxChunks = 256;
+
+    template <typename Fn>
+    static void parallel(ThreadPool* pool, int count, Fn&& fn) {
+        if (pool) pool->parallelFor(count, [&](int i) { fn(i); });
+        else for (int i = 0; i < count; ++i) fn(i);
+    }
+
+    // How many chunks forChunks splits count items into: several per
+    // thread for a big range on a pool, otherwise one.
+    static int chunkCount(ThreadPool* pool, int count) {
+        if (!pool || pool->size() == 1 || count < 2 * parallelGrain) return 1;
+        return std::min(std::min(4 * pool->size(), count / parallelGrain), maxChunks);
+    }
+
+    // Runs fn(begin, end, chunk) over the chunks of [first, first + count).
+    template <typename Fn>
+    static void forChunks(ThreadPool* pool, int first, int count, Fn&& fn) {
+        int chunks = chunkCount(pool, count);
+        if (chunks == 1) {
+            fn(first, first + count, 0);
+            return;
+        }
+        pool->parallelFor(chunks, [&](int c) {
+            fn(first + static_cast<int>(static_cast<int64_t>(count) * c / chunks),
+                first + static_cast<int>(static_cast<int64_t>(count) * (c + 1) / chunks), c);
+        });
+    }
+
+    static void growByCentroid(Aabb& box, const Circle& circle) {
+        box.min = Vec2(std::min(box.min.x, circle.center.x), std::min(box.min.y, circle.center.y));
+        box.max = Vec2(std::max(box.max.x, circle.center.x), std::max(box.max.y, circle.center.y));
+    }
+
+    Aabb centroidBounds(int first, int count, ThreadPool* pool) const {
+        Aabb partial[maxChunks];
+        forChunks(pool, first, count, [&](int begin, int end, int c) {
+            for (int i = begin; i < end; ++i) growByCentroid(partial[c], primitives[i]);
+        });
+        Aabb bounds;
+        for (int c = 0; c < chunkCount(pool, count); ++c) bounds.grow(partial[c]);
+        return bounds;
+    }
+
+    // Splits node index of list in two, appending the children to list;
+    // false when it stays a leaf.
+    bool split(BvhBuilder builder, const std::vector<uint32_t>& codes, std::vector<BvhNode>& list, int index, int depth, ThreadPool* pool) {
+        int first = list[index].first;
+        int count = list[index].count;
+        if (count <= maxLeafSize) return false;
+
+        Aabb centroids = list[index].bounds;
+        Aabb left, right;
+        int half;
+        // The LBVH's primitives are already in curve order; its median is the
+        // middle of the run.
+        if (builder == BvhBuilder::Lbvh) half = depth < maxHeuristicDepth ? splitMorton(codes, first, count) : count / 2;
+        else if (builder == BvhBuilder::BinnedSah && depth < maxHeuristicDepth) half = splitSah(first, count, centroids, left, right, pool);
+        else half = splitMedian(first, count, centroids, left, right, pool);
+
+        int child = static_cast<int>(list.size());
+        list.push_back(BvhNode{ left, first, half });
+        list.push_back(BvhNode{ right, first + half, count - half });
+        list[index].first = child;
+        list[index].count = 0;
+        return true;
+    }
+
+    int splitMedian(int first, int count, const Aabb& centroids, Aabb& left, Aabb& right, ThreadPool* pool) {
+        Vec2 extent = centroids.extent();
+        bool splitX = extent.x >= extent.y;
+        int half = count / 2;
+        std::nth_element(primitives.begin() + first, primitives.begin() + first + half,
+            primitives.begin() + first + count,
+            [splitX](const Circle& a, const Circle& b) {
+                return splitX ? a.center.x < b.center.x : a.center.y < b.center.y;
+            });
+        left = centroidBounds(first, half, pool);
+        right = centroidBounds(first + half, count - half, pool);
+        return half;
+    }
+
+    struct SahBin {
+        Aabb bounds;
+        int count = 0;
+    };
+
+    // Bins the centroids on both axes and splits at the bin boundary with
+    // the lowest perimeter-weighted count. Returns the left child's size.
+    int splitSah(int first, int count, const Aabb& centroids, Aabb& left, Aabb& right, ThreadPool* pool) {
+        Vec2 extent = centroids.extent();
+        // Slightly under sahBins per extent so the largest centroid still
+        // lands in the last bin.
+        Vec2 scale(extent.x > 0 ? sahBins * 0.9999f / extent.x : 0.0f, extent.y > 0 ? sahBins * 0.9999f / extent.y : 0.0f);
+        if (scale.x == 0.0f && scale.y == 0.0f) return splitMedian(first, count, centroids, left, right, pool);
+        auto binX = [&](const Circle& c) { return static_cast<int>((c.center.x - centroids.min.x) * scale.x); };
+        auto binY = [&](const Circle& c) { return static_cast<int>((c.center.y - centroids.min.y) * scale.y); };
+
+        int chunks = chunkCount(pool, count);
+        std::vector<SahBin> partial(chunks > 1 ? chunks * 2 * sahBins : 0);
+        SahBin bins[2 * sahBins];
+        forChunks(pool, first, count, [&](int begin, int end, int c) {
+            SahBin* out = chunks > 1 ? &partial[c * 2 * sahBins] : bins;
+            for (int i = begin; i < end; ++i) {
+                const Circle& circle = primitives[i];
+                Aabb box = boundsOf(circle);
+                SahBin& x = out[binX(circle)];
+                SahBin& y = out[sahBins + binY(circle)];
+                x.bounds.grow(box);
+                ++x.count;
+                y.bounds.grow(box);
+                ++y.count;
+            }
+        });
+        for (size_t i = 0; i < partial.size(); ++i) {
+            bins[i % (2 * sahBins)].bounds.grow(partial[i].bounds);
+            bins[i % (2 * sahBins)].count += partial[i].count;
+        }
+
+        float bestCost = 1e38f;
+        int bestAxis = -1;
+        int bestBin = 0;
+        for (int axis = 0; axis < 2; ++axis) {
+            if ((axis ? scale.y : scale.x) == 0.0f) continue;
+            const SahBin* axisBins = &bins[axis * sahBins];
+            // rightCost[b]: cost of bins b and above as one child.
+            float rightCost[sahBins];
+            Aabb box;
+            int n = 0;
+            for (int b = sahBins - 1; b > 0; --b) {
+                box.grow(axisBins[b].bounds);
+                n += axisBins[b].count;
+                rightCost[b] = n ? box.perimeter() * n : 0.0f;
+            }
+            box = Aabb();
+            n = 0;
+            for (int b = 0; b < sahBins - 1; ++b) {
+                box.grow(axisBins[b].bounds);
+                n += axisBins[b].count;
+                if (n == 0 || n == count) continue;
+                float cost = box.perimeter() * n + rightCost[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+        if (bestAxis < 0) return splitMedian(first, count, centroids, left, right, pool);
+
+        // Partitions in place, growing each side's centroid bounds on the way.
+        auto goesLeft = [&](const Circle& c) { return (bestAxis ? binY(c) : binX(c)) <= bestBin; };
+        Circle* lo = primitives.data() + first;
+        Circle* hi = lo + count;
+        for (;;) {
+            while (lo < hi && goesLeft(*lo)) growByCentroid(left, *lo++);
+            while (lo < hi && !goesLeft(hi[-1])) growByCentroid(right, *--hi);
+            if (lo == hi) break;
+            std::swap(*lo, hi[-1]);
+        }
+        return static_cast<int>(lo - (primitives.data() + first));
+    }
+
+    // True when the highest set bit of a is below that of b.
+    static bool highestBitBelow(uint32_t a, uint32_t b) {
+        return a < b && a < (a ^ b);
+    }
+
+    // codes are sorted, so the node's primitives whose code has the highest
+    // differing bit clear come first; splits there, or in the middle when
+    // all codes are equal.
+    static int splitMorton(const std::vector<uint32_t>& codes, int first, int count) {
+        uint32_t low = codes[first];
+        uint32_t differ = low ^ codes[first + count - 1];
+        if (differ == 0) return count / 2;
+        const uint32_t* begin = codes.data() + first;
+        const uint32_t* middle = std::partition_point(begin, begin + count,
+            [&](uint32_t code) { return highestBitBelow(code ^ low, differ); });
+        return static_cast<int>(middle - begin);
+    }
+
+    // Copies circles into primitives in order along a Morton curve over
+    // their centroids, 16 bits per axis, and returns their codes in that
+    // order. Keys are radix sorted with the circles' indices, 11 bits per
+    // pass.
+    void sortAlongMortonCurve(const std::vector<Circle>& circles, std::vector<uint32_t>& codes, ThreadPool* pool) {
+        int count = static_cast<int>(circles.size());
+        Aabb centroids;
+        for (const Circle& circle : circles) growByCentroid(centroids, circle);
+        Vec2 extent = centroids.extent();
+        Vec2 scale(extent.x > 0 ? 65535.0f / extent.x : 0.0f, extent.y > 0 ? 65535.0f / extent.y : 0.0f);
+        std::vector<uint64_t> keys(count), spare(count);
+        forChunks(pool, 0, count, [&](int begin, int end, int) {
+            for (int i = begin; i < end; ++i) {
+                Vec2 c = circles[i].center - centroids.min;
+                uint32_t code = mortonCode(static_cast<uint32_t>(c.x * scale.x), static_cast<uint32_t>(c.y * scale.y));
+                keys[i] = static_cast<uint64_t>(code) << 32 | static_cast<uint32_t>(i);
+            }
+        });
+
+        // Stable on every chunk at once: each chunk scatters its keys after
+        // those of the same digit from earlier chunks.
+        const int digitBits = 11;
+        const uint32_t digitMask = (1u << digitBits) - 1;
+        int chunks = chunkCount(pool, count);
+        std::vector<uint32_t> offsets(static_cast<size_t>(chunks) << digitBits);
+        for (int shift = 32; shift < 64; shift += digitBits) {
+            std::fill(offsets.begin(), offsets.end(), 0);
+            forChunks(pool, 0, count, [&](int begin, int end, int c) {
+                uint32_t* histogram = &offsets[static_cast<size_t>(c) << digitBits];
+                for (int i = begin; i < end; ++i) ++histogram[(keys[i] >> shift) & digitMask];
+            });
+            uint32_t sum = 0;
+            for (uint32_t digit = 0; digit <= digitMask; ++digit) {
+                for (int c = 0; c < chunks; ++c) {
+                    uint32_t& offset = offsets[(static_cast<size_t>(c) << digitBits) + digit];
+                    uint32_t size = offset;
+                    offset = sum;
+                    sum += size;
+                }
+            }
+            forChunks(pool, 0, count, [&](int begin, int end, int c) {
+                uint32_t* next = &offsets[static_cast<size_t>(c) << digitBits];
+                for (int i = begin; i < end; ++i) spare[next[(keys[i] >> shift) & digitMask]++] = keys[i];
+            });
+            keys.swap(spare);
+        }
+
+        primitives.resize(count);
+        codes.resize(count);
+        forChunks(pool, 0, count, [&](int begin, int end, int) {
+            for (int i = begin; i < end; ++i) {
+                primitives[i] = circles[static_cast<uint32_t>(keys[i])];
+                codes[i] = static_cast<uint32_t>(keys[i] >> 32);
+            }
+        });
+    }
+
+    // Bounds, proxy and proxy area (into areas) of nodes [begin, end), whose
+    // children outside that range are done. Children always come after
+    // their parent in the node array, so a reverse sweep sees both children
+    // before the parent.
+    void buildBoundsAndProxies(size_t begin, size_t end, std::vector<float>& areas) {
+        for (size_t i = end; i-- > begin;) {
+            BvhNode& node = nodes[i];
+            Vec2 weighted;
+            float area = 0.0f;
+            node.bounds = Aabb();
+            if (node.isLeaf()) {
+                for (int p = node.first; p < node.first + node.count; ++p) {
+                    node.bounds.grow(boundsOf(primitives[p]));
+                    float a = primitives[p].radius * primitives[p].radius;
+                    weighted = weighted + primitives[p].center * a;
+                    area += a;
+                }
+            }
+            else {
+                for (int c = node.first; c <= node.first + 1; ++c) {
+                    node.bounds.grow(nodes[c].bounds);
+                    weighted = weighted + proxies[c].shape.center * areas[c];
+                    area += areas[c];
+                }
+            }
+
+            Vec2 extent = node.bounds.extent();
+            float size = std::max(extent.x, extent.y);
+            areas[i] = area;
+            proxies[i].shape.center = area > 0 ? weighted * (1.0f / area) : node.bounds.center();
+            proxies[i].shape.radius = std::min(std::sqrt(area), size * 0.5f);
+            proxies[i].size = size;
+        }
+    }
+
+    std::vector<BvhNode> nodes;
+    std::vector<BvhProxy> proxies;
+    std::vector<Circle> primitives;
+};
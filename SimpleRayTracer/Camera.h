@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "Geometry.h"
+#include "Vec2.h"
+
+// 2D view: the world point at the centre of the screen, a zoom in pixels per
+// world unit, and a rotation. The default camera on an 800x600 screen maps
+// world coordinates straight onto pixels.
+struct Camera {
+    Vec2 center = Vec2(400, 300);
+    float zoom = 1.0f;
+    float rotation = 0.0f;
+    Vec2 screenSize = Vec2(800, 600);
+
+    Vec2 worldToScreen(const Vec2& world) const {
+        Vec2 d = world - center;
+        float c = std::cos(rotation);
+        float s = std::sin(rotation);
+        return Vec2((d.x * c - d.y * s) * zoom + screenSize.x * 0.5f,
+                    (d.x * s + d.y * c) * zoom + screenSize.y * 0.5f);
+    }
+
+    Vec2 screenToWorld(const Vec2& screen) const {
+        Vec2 d((screen.x - screenSize.x * 0.5f) / zoom, (screen.y - screenSize.y * 0.5f) / zoom);
+        float c = std::cos(rotation);
+        float s = std::sin(rotation);
+        return Vec2(d.x * c + d.y * s, -d.x * s + d.y * c) + center;
+    }
+
+    // The same view on a screen of a different resolution, e.g. an internal
+    // render target smaller than the window.
+    Camera resized(int width, int height) const {
+        Camera camera = *this;
+        camera.zoom = zoom * std::min(width / screenSize.x, height / screenSize.y);
+        camera.screenSize = Vec2(static_cast<float>(width), static_cast<float>(height));
+        return camera;
+    }
+
+    // The part of this view under the screen rectangle at (x, y), as a view
+    // of its own; tiles rendered with it line up pixel for pixel.
+    Camera cropped(int x, int y, int width, int height) const {
+        Camera camera = *this;
+        camera.center = screenToWorld(Vec2(x + width * 0.5f, y + height * 0.5f));
+        camera.screenSize = Vec2(static_cast<float>(width), static_cast<float>(height));
+        return camera;
+    }
+
+    // World-space offset of one pixel to the right / one pixel down.
+    Vec2 pixelStepX() const { return Vec2(std::cos(rotation), -std::sin(rotation)) * (1.0f / zoom); }
+    Vec2 pixelStepY() const { return Vec2(std::sin(rotation), std::cos(rotation)) * (1.0f / zoom); }
+
+    // World-space bounds of everything on screen; with rotation this is the
+    // box around the rotated screen rectangle.
+    Aabb visibleBounds() const {
+        Aabb box;
+        const Vec2 corners[4] = {
+            Vec2(0, 0), Vec2(screenSize.x, 0), Vec2(0, screenSize.y), screenSize
+        };
+        for (const Vec2& corner : corners) {
+            Vec2 w = screenToWorld(corner);
+            box.grow(Aabb(w, w));
+        }
+        return box;
+    }
+
+    void pan(const Vec2& screenDelta) {
+        Vec2 before = screenToWorld(screenSize * 0.5f);
+        Vec2 after = screenToWorld(screenSize * 0.5f + screenDelta);
+        center = center - (after - before);
+    }
+
+    // Zooms by factor while keeping the world point under screenPoint fixed.
+    void zoomAt(const Vec2& screenPoint, float factor) {
+        Vec2 anchor = screenToWorld(screenPoint);
+        zoom = std::min(std::max(zoom * factor, 1e-4f), 1e4f);
+        center = center + (anchor - screenToWorld(screenPoint));
+    }
+
+    void rotateAt(const Vec2& screenPoint, float radians) {
+        Vec2 anchor = screenToWorld(screenPoint);
+        rotation += radians;
+        center = center + (anchor - screenToWorld(screenPoint));
+    }
+
+    // Centres on box and zooms out until all of it fits.
+    void frame(const Aabb& box) {
+        center = box.center();
+        Vec2 extent = box.extent();
+        zoom = std::min(screenSize.x / std::max(extent.x, 1.0f), screenSize.y / std::max(extent.y, 1.0f));
+        rotation = 0.0f;
+    }
+};
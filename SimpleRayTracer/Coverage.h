@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include "Framebuffer.h"
+
+// Float coverage for rows [y0, y1) of one render band, row-major. Lines add
+// into it in any order; resolveCoverage() then blends a single colour over
+// the framebuffer in proportion to the clamped total, so overlapping rays
+// saturate instead of depending on draw order.
+struct CoverageBand {
+    float* data;
+    int width;
+    int y0, y1;
+
+    void clear() { std::fill(data, data + static_cast<size_t>(width) * (y1 - y0), 0.0f); }
+    const float* row(int y) const { return data + static_cast<size_t>(y - y0) * width; }
+
+    void add(int x, int y, float value) { data[static_cast<size_t>(y - y0) * width + x] += value; }
+};
+
+// One sample per pixel step along the major axis (Wu's algorithm): the
+// sample is split between the two pixels straddling the line on the minor
+// axis by distance to their centres, and scaled by how much of the step the
+// segment covers, which gives sub-pixel endpoints. a is the major and b the
+// minor coordinate; Steep says whether the major axis is y.
+template <bool Steep>
+void accumulateSpan(CoverageBand& band, float a0, float b0, float a1, float b1, float weight) {
+    if (a1 < a0) {
+        std::swap(a0, a1);
+        std::swap(b0, b1);
+    }
+    float length = a1 - a0;
+    float gradient = length > 1e-6f ? (b1 - b0) / length : 0.0f;
+    const int majorEnd = Steep ? band.y1 : band.width;
+    const int minorBegin = Steep ? 0 : band.y0;
+    const int minorEnd = Steep ? band.width : band.y1;
+
+    // Steps inside the band or image on the major axis, narrowed to those
+    // whose minor position can touch the band or image on the other one.
+    float lo = std::max(std::floor(a0), static_cast<float>(Steep ? band.y0 : 0));
+    float hi = std::min(std::ceil(a1), static_cast<float>(majorEnd)) - 1;
+    if (gradient != 0.0f) {
+        float ta = a0 + (minorBegin - 1.5f - b0) / gradient;
+        float tb = a0 + (minorEnd + 0.5f - b0) / gradient;
+        if (ta > tb) std::swap(ta, tb);
+        lo = std::max(lo, std::floor(ta));
+        hi = std::min(hi, std::ceil(tb));
+    }
+    else if (b0 < minorBegin - 1 || b0 > minorEnd + 1) {
+        return;
+    }
+    if (lo > hi) return;
+    int first = static_cast<int>(lo);
+    int last = static_cast<int>(hi);
+
+    auto plot = [&](int major, int minor, float value) {
+        if (minor < minorBegin || minor >= minorEnd || value <= 0.0f) return;
+        if (Steep) band.add(minor, major, value);
+        else band.add(major, minor, value);
+    };
+
+    int i = first;
+#ifdef SRT_SSE2
+    // The position, weights and endpoint coverage of four steps at a time;
+    // the adds themselves go to four different rows or columns.
+    const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 vA0 = _mm_set1_ps(a0);
+    const __m128 vA1 = _mm_set1_ps(a1);
+    const __m128 vB0 = _mm_set1_ps(b0 - 0.5f);
+    const __m128 vGradient = _mm_set1_ps(gradient);
+    const __m128 vWeight = _mm_set1_ps(weight);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    // Positions are at least -2 here, so truncating after an offset floors.
+    const __m128 offset = _mm_set1_ps(16.0f);
+    // Cells whose pair of pixels both lie within the band or image.
+    const __m128i firstCell = _mm_set1_epi32(minorBegin - 1);
+    const __m128i lastCell = _mm_set1_epi32(minorEnd - 1);
+    for (; i + 4 <= last + 1; i += 4) {
+        __m128 center = _mm_add_ps(_mm_set1_ps(static_cast<float>(i)), lane);
+        __m128 b = _mm_add_ps(vB0, _mm_mul_ps(vGradient, _mm_sub_ps(center, vA0)));
+        __m128i cell = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(b, offset)), _mm_set1_epi32(16));
+        __m128 f = _mm_sub_ps(b, _mm_cvtepi32_ps(cell));
+        __m128 start = _mm_sub_ps(center, half);
+        __m128 covered = _mm_sub_ps(_mm_min_ps(_mm_add_ps(start, one), vA1), _mm_max_ps(start, vA0));
+        covered = _mm_mul_ps(_mm_min_ps(_mm_max_ps(covered, zero), one), vWeight);
+
+        alignas(16) int cells[4];
+        alignas(16) float nearWeight[4];
+        alignas(16) float farWeight[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(cells), cell);
+        _mm_store_ps(farWeight, _mm_mul_ps(covered, f));
+        _mm_store_ps(nearWeight, _mm_sub_ps(covered, _mm_load_ps(farWeight)));
+        // Most groups lie well inside the band; they add without checks.
+        __m128i inside = _mm_and_si128(_mm_cmpgt_epi32(cell, firstCell), _mm_cmplt_epi32(cell, lastCell));
+        if (_mm_movemask_epi8(inside) == 0xFFFF) {
+            for (int l = 0; l < 4; ++l) {
+                float* p = Steep ? band.data + static_cast<size_t>(i + l - band.y0) * band.width + cells[l]
+                                 : band.data + static_cast<size_t>(cells[l] - band.y0) * band.width + i + l;
+                p[0] += nearWeight[l];
+                p[Steep ? 1 : band.width] += farWeight[l];
+            }
+            continue;
+        }
+        for (int l = 0; l < 4; ++l) {
+            plot(i + l, cells[l], nearWeight[l]);
+            plot(i + l, cells[l] + 1, farWeight[l]);
+        }
+    }
+#endif
+    for (; i <= last; ++i) {
+        float center = i + 0.5f;
+        float b = b0 - 0.5f + gradient * (center - a0);
+        int cell = static_cast<int>(std::floor(b));
+        float f = b - cell;
+        float covered = std::min(static_cast<float>(i + 1), a1) - std::max(static_cast<float>(i), a0);
+        covered = std::min(std::max(covered, 0.0f), 1.0f) * weight;
+        plot(i, cell, covered * (1.0f - f));
+        plot(i, cell + 1, covered * f);
+    }
+}
+
+// Anti-aliased segment between continuous coordinates, where pixel (x, y)
+// covers [x, x + 1) x [y, y + 1). Only the band's rows are written.
+inline void accumulateLine(CoverageBand& band, float x0, float y0, float x1, float y1, float weight) {
+    if (std::fabs(y1 - y0) > std::fabs(x1 - x0)) accumulateSpan<true>(band, y0, x0, y1, x1, weight);
+    else accumulateSpan<false>(band, x0, y0, x1, y1, weight);
+}
+
+// Blends color over fb with alpha = min(coverage, 1) for every covered pixel
+// of the band. Empty groups of four are skipped with one compare.
+template <typename Framebuffer>
+void resolveCoverage(Framebuffer& fb, const CoverageBand& band, uint32_t color) {
+    for (int y = band.y0; y < band.y1; ++y) {
+        const float* row = band.row(y);
+        int x = 0;
+#ifdef SRT_SSE2
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        for (; x + 4 <= band.width; x += 4) {
+            __m128 c = _mm_loadu_ps(row + x);
+            if (_mm_movemask_ps(_mm_cmpgt_ps(c, zero)) == 0) continue;
+            alignas(16) int alpha[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(alpha), _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(c, one), scale)));
+            for (int l = 0; l < 4; ++l) {
+                if (alpha[l] <= 0) continue;
+                uint32_t& p = fb.at(x + l, y);
+                p = blendColor(p, color, alpha[l]);
+            }
+        }
+#endif
+        for (; x < band.width; ++x) {
+            int alpha = static_cast<int>(std::min(row[x], 1.0f) * 255.0f + 0.5f);
+            if (alpha <= 0) continue;
+            uint32_t& p = fb.at(x, y);
+            p = blendColor(p, color, alpha);
+        }
+    }
+}
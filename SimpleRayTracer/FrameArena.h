@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+#ifdef SRT_PROFILE
+#include "AllocationTracker.h"
+#endif
+
+// Bump allocator for data that lives for exactly one frame. Memory is handed
+// out linearly from one block and released all at once by reset(). If a frame
+// needs more than the block holds, overflow blocks are chained on and the next
+// reset() replaces everything with a single block sized to the peak, so after
+// a short warm-up the arena stops touching the heap entirely.
+class FrameArena {
+public:
+    explicit FrameArena(size_t initialCapacity = 256 * 1024) {
+        head = newBlock(initialCapacity, nullptr);
+    }
+
+    ~FrameArena() {
+        releaseBlocks(head);
+    }
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+        uintptr_t base = reinterpret_cast<uintptr_t>(head->data());
+        size_t offset = alignUp(base + head->used, alignment) - base;
+
+        if (offset + bytes > head->capacity) {
+            size_t size = head->capacity * 2;
+            while (size < bytes + alignment) size *= 2;
+            head = newBlock(size, head);
+            base = reinterpret_cast<uintptr_t>(head->data());
+            offset = alignUp(base, alignment) - base;
+        }
+
+        head->used = offset + bytes;
+        frameBytes += bytes;
+        return head->data() + offset;
+    }
+
+    template <typename T>
+    T* allocArray(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value,
+            "FrameArena never runs destructors");
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    void reset() {
+        if (head->next) {
+            size_t total = 0;
+            for (Block* b = head; b; b = b->next) total += b->capacity;
+            releaseBlocks(head);
+            head = newBlock(total, nullptr);
+        }
+        head->used = 0;
+        peakBytes = frameBytes > peakBytes ? frameBytes : peakBytes;
+        frameBytes = 0;
+    }
+
+    size_t capacity() const { return head->capacity; }
+    size_t bytesThisFrame() const { return frameBytes; }
+    size_t peakFrameBytes() const { return peakBytes; }
+    size_t heapAllocations() const { return blockAllocations; }
+
+    // Arenas are per thread; rather than each owner resetting its own at the
+    // right moment, the frame loop bumps a global epoch and every thread's
+    // arena resets itself on first use in the new frame.
+    static void beginFrame() {
+        epochCounter().fetch_add(1, std::memory_order_release);
+    }
+
+    static FrameArena& forThisThread() {
+        thread_local FrameArena arena;
+        uint64_t epoch = epochCounter().load(std::memory_order_acquire);
+        if (arena.epoch != epoch) {
+            arena.reset();
+            arena.epoch = epoch;
+        }
+        return arena;
+    }
+
+private:
+    struct Block {
+        Block* next;
+        size_t capacity;
+        size_t used;
+        unsigned char* data() { return reinterpret_cast<unsigned char*>(this + 1); }
+    };
+
+    static uintptr_t alignUp(uintptr_t p, size_t alignment) {
+        return (p + alignment - 1) & ~static_cast<uintptr_t>(alignment - 1);
+    }
+
+    static std::atomic<uint64_t>& epochCounter() {
+        static std::atomic<uint64_t> counter(0);
+        return counter;
+    }
+
+    Block* newBlock(size_t capacity, Block* next) {
+        void* memory = std::malloc(sizeof(Block) + capacity);
+        if (!memory) throw std::bad_alloc();
+        ++blockAllocations;
+#ifdef SRT_PROFILE
+        AllocationTracker::recordAllocation(sizeof(Block) + capacity);
+#endif
+        Block* b = static_cast<Block*>(memory);
+        b->next = next;
+        b->capacity = capacity;
+        b->used = 0;
+        return b;
+    }
+
+    static void releaseBlocks(Block* b) {
+        while (b) {
+            Block* next = b->next;
+            std::free(b);
+            b = next;
+        }
+    }
+
+    Block* head = nullptr;
+    size_t frameBytes = 0;
+    size_t peakBytes = 0;
+    size_t blockAllocations = 0;
+    uint64_t epoch = 0;
+};
+
+// Growable array backed by a FrameArena. Growing copies into a fresh arena
+// allocation and abandons the old storage until the next reset, which is
+// cheap compared to a heap round trip and keeps element types trivial.
+template <typename T>
+class ArenaVector {
+    static_assert(std::is_trivially_copyable<T>::value,
+        "ArenaVector relocates elements with memcpy");
+
+public:
+    explicit ArenaVector(FrameArena& arena, size_t initialCapacity = 0)
+        : arena(&arena) {
+        if (initialCapacity) reserve(initialCapacity);
+    }
+
+    void reserve(size_t n) {
+        if (n <= cap) return;
+        T* storage = arena->allocArray<T>(n);
+        if (count) std::memcpy(storage, items, sizeof(T) * count);
+        items = storage;
+        cap = n;
+    }
+
+    void push_back(const T& value) {
+        if (count == cap) reserve(cap ? cap * 2 : 16);
+        items[count++] = value;
+    }
+
+    void clear() { count = 0; }
+
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T* begin() { return items; }
+    T* end() { return items + count; }
+    const T* begin() const { return items; }
+    const T* end() const { return items + count; }
+    T* data() { return items; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+private:
+    FrameArena* arena;
+    T* items = nullptr;
+    size_t count = 0;
+    size_t cap = 0;
+};
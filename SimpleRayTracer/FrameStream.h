@@ -0,0 +1,398 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Net.h"
+#include "ThreadPool.h"
+
+// Streams rendered frames to a remote viewer over TCP and carries its mouse
+// and keyboard input back. All integers are little-endian.
+//
+// Server to viewer, once per frame:
+//     "SRTF", u16 width, u16 height, u32 block count, u32 payload bytes
+//     then per block: u16 block x, u16 block y, u32 bytes, encoded pixels
+// The image is cut into BlockSize x BlockSize blocks and only blocks that
+// differ from the previous frame are sent, so a static frame is a bare
+// header. A block is the QOI encoding of its pixels in row-major order
+// (the op stream only, without QOI's header or end marker, with the
+// encoder state reset per block). Pixels are opaque XRGB.
+//
+// Viewer to server: fixed InputEvent::WireSize byte messages.
+
+// Interaction in output pixels, from the local window or a remote viewer.
+struct InputEvent {
+    enum Type : uint8_t { MouseDown, MouseUp, MouseMove, Wheel, Key, Resize };
+    static const int WireSize = 16;
+
+    uint8_t type = MouseMove;
+    uint8_t button = 0;     // SDL_BUTTON_* for MouseDown and MouseUp
+    uint8_t buttons = 0;    // SDL_BUTTON_*MASK bits held during MouseMove
+    int16_t x = 0, y = 0;   // position, or the new output size for Resize
+    int16_t dx = 0, dy = 0; // relative motion
+    int32_t value = 0;      // wheel steps or SDL keycode
+
+    void encode(uint8_t* out) const {
+        out[0] = type;
+        out[1] = button;
+        out[2] = buttons;
+        out[3] = 0;
+        put16(out + 4, static_cast<uint16_t>(x));
+        put16(out + 6, static_cast<uint16_t>(y));
+        put16(out + 8, static_cast<uint16_t>(dx));
+        put16(out + 10, static_cast<uint16_t>(dy));
+        put32(out + 12, static_cast<uint32_t>(value));
+    }
+
+    static InputEvent decode(const uint8_t* in) {
+        InputEvent event;
+        event.type = in[0];
+        event.button = in[1];
+        event.buttons = in[2];
+        event.x = static_cast<int16_t>(get16(in + 4));
+        event.y = static_cast<int16_t>(get16(in + 6));
+        event.dx = static_cast<int16_t>(get16(in + 8));
+        event.dy = static_cast<int16_t>(get16(in + 10));
+        event.value = static_cast<int32_t>(get32(in + 12));
+        return event;
+    }
+
+    static void put16(uint8_t* p, uint16_t v) {
+        p[0] = static_cast<uint8_t>(v);
+        p[1] = static_cast<uint8_t>(v >> 8);
+    }
+    static void put32(uint8_t* p, uint32_t v) {
+        put16(p, static_cast<uint16_t>(v));
+        put16(p + 2, static_cast<uint16_t>(v >> 16));
+    }
+    static uint16_t get16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+    static uint32_t get32(const uint8_t* p) { return get16(p) | (static_cast<uint32_t>(get16(p + 2)) << 16); }
+};
+
+// QOI ops over one block. Alpha is always 255, so QOI_OP_RGBA never occurs.
+namespace BlockCodec {
+    const uint8_t OpIndex = 0x00;
+    const uint8_t OpDiff = 0x40;
+    const uint8_t OpLuma = 0x80;
+    const uint8_t OpRun = 0xC0;
+    const uint8_t OpRgb = 0xFE;
+
+    inline int hash(uint32_t p) {
+        return (((p >> 16) & 0xFF) * 3 + ((p >> 8) & 0xFF) * 5 + (p & 0xFF) * 7 + 255 * 11) & 63;
+    }
+
+    // The most encode() can append for w x h pixels: every pixel an RGB op.
+    inline size_t maxEncodedSize(int w, int h) { return static_cast<size_t>(w) * h * 4; }
+
+    // Appends the encoding of the w x h pixels at pixels (rows stride
+    // pixels apart) to out.
+    inline void encode(const uint32_t* pixels, int stride, int w, int h, std::vector<uint8_t>& out) {
+        uint32_t index[64] = {};
+        uint32_t previous = 0xFF000000u;
+        int run = 0;
+        for (int y = 0; y < h; ++y) {
+            const uint32_t* row = pixels + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < w; ++x) {
+                uint32_t p = row[x] | 0xFF000000u;
+                if (p == previous) {
+                    if (++run == 62) {
+                        out.push_back(static_cast<uint8_t>(OpRun | (run - 1)));
+                        run = 0;
+                    }
+                    continue;
+                }
+                if (run > 0) {
+                    out.push_back(static_cast<uint8_t>(OpRun | (run - 1)));
+                    run = 0;
+                }
+                int slot = hash(p);
+                if (index[slot] == p) {
+                    out.push_back(static_cast<uint8_t>(OpIndex | slot));
+                }
+                else {
+                    index[slot] = p;
+                    int dr = static_cast<int8_t>(((p >> 16) & 0xFF) - ((previous >> 16) & 0xFF));
+                    int dg = static_cast<int8_t>(((p >> 8) & 0xFF) - ((previous >> 8) & 0xFF));
+                    int db = static_cast<int8_t>((p & 0xFF) - (previous & 0xFF));
+                    int drg = dr - dg;
+                    int dbg = db - dg;
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                        out.push_back(static_cast<uint8_t>(OpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                    }
+                    else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                        out.push_back(static_cast<uint8_t>(OpLuma | (dg + 32)));
+                        out.push_back(static_cast<uint8_t>((drg + 8) << 4 | (dbg + 8)));
+                    }
+                    else {
+                        uint8_t rgb[4] = { OpRgb, static_cast<uint8_t>(p >> 16), static_cast<uint8_t>(p >> 8), static_cast<uint8_t>(p) };
+                        out.insert(out.end(), rgb, rgb + 4);
+                    }
+                }
+                previous = p;
+            }
+        }
+        if (run > 0) out.push_back(static_cast<uint8_t>(OpRun | (run - 1)));
+    }
+
+    // Decodes exactly w x h pixels; false if the data runs out early.
+    inline bool decode(const uint8_t* data, size_t size, uint32_t* pixels, int stride, int w, int h) {
+        uint32_t index[64] = {};
+        uint32_t p = 0xFF000000u;
+        const uint8_t* end = data + size;
+        int run = 0;
+        for (int y = 0; y < h; ++y) {
+            uint32_t* row = pixels + static_cast<size_t>(y) * stride;
+            for (int x = 0; x < w; ++x) {
+                if (run > 0) {
+                    --run;
+                }
+                else {
+                    if (data >= end) return false;
+                    uint8_t op = *data++;
+                    if (op == OpRgb) {
+                        if (end - data < 3) return false;
+                        p = 0xFF000000u | (static_cast<uint32_t>(data[0]) << 16) | (data[1] << 8) | data[2];
+                        data += 3;
+                    }
+                    else if ((op & 0xC0) == OpIndex) {
+                        p = index[op & 63];
+                    }
+                    else if ((op & 0xC0) == OpDiff) {
+                        uint32_t r = ((p >> 16) + ((op >> 4) & 3) - 2) & 0xFF;
+                        uint32_t g = ((p >> 8) + ((op >> 2) & 3) - 2) & 0xFF;
+                        uint32_t b = (p + (op & 3) - 2) & 0xFF;
+                        p = 0xFF000000u | r << 16 | g << 8 | b;
+                    }
+                    else if ((op & 0xC0) == OpLuma) {
+                        if (data >= end) return false;
+                        int dg = (op & 63) - 32;
+                        int dr = dg + (*data >> 4) - 8;
+                        int db = dg + (*data & 15) - 8;
+                        ++data;
+                        uint32_t r = ((p >> 16) + dr) & 0xFF;
+                        uint32_t g = ((p >> 8) + dg) & 0xFF;
+                        uint32_t b = (p + db) & 0xFF;
+                        p = 0xFF000000u | r << 16 | g << 8 | b;
+                    }
+                    else {
+                        run = op & 63;
+                    }
+                    index[hash(p)] = p;
+                }
+                row[x] = p;
+            }
+        }
+        return true;
+    }
+}
+
+// Accepts one viewer at a time and sends it the blocks that changed since
+// the last frame it received. The framebuffer is copied to a row-major
+// image and diffed and encoded in parallel, one band of blocks per task;
+// all buffers are kept between frames.
+class FrameStreamServer {
+public:
+    static const int BlockSize = 32;
+    // The widest or tallest frame either end accepts.
+    static const int MaxSize = 8192;
+
+    // The longest frame payload for a w x h image: every block sent, each
+    // at its worst-case encoding.
+    static size_t maxPayload(int w, int h) {
+        size_t blocks = static_cast<size_t>((w + BlockSize - 1) / BlockSize) * ((h + BlockSize - 1) / BlockSize);
+        return blocks * (8 + BlockCodec::maxEncodedSize(BlockSize, BlockSize));
+    }
+
+    bool listen(const char* address, int port) {
+        listener = TcpSocket::listen(address, port);
+        return listener.valid();
+    }
+
+    bool connected() const { return client.valid(); }
+
+    // Waits up to timeoutMs for a viewer; the first frame it gets is sent
+    // in full.
+    bool waitForClient(int timeoutMs) {
+        client = listener.accept(timeoutMs);
+        previous.clear();
+        pending.clear();
+        return client.valid();
+    }
+
+    // Input that has arrived since the last call, without waiting. Returns
+    // false once there is none; a lost connection also closes the client.
+    bool pollInput(InputEvent& event) {
+        if (pending.size() < InputEvent::WireSize && client.valid()) {
+            uint8_t buffer[64 * InputEvent::WireSize];
+            int received = client.receiveSome(buffer, sizeof(buffer), 0);
+            if (received < 0) client.close();
+            if (received > 0) pending.insert(pending.end(), buffer, buffer + received);
+        }
+        if (pending.size() < InputEvent::WireSize) return false;
+        event = InputEvent::decode(pending.data());
+        pending.erase(pending.begin(), pending.begin() + InputEvent::WireSize);
+        return true;
+    }
+
+    // Sends fb as one frame message. Returns false, and drops the viewer,
+    // if it could not be written.
+    template <typename Framebuffer>
+    bool sendFrame(ThreadPool& pool, const Framebuffer& fb) {
+        int width = fb.getWidth();
+        int height = fb.getHeight();
+        size_t pixels = static_cast<size_t>(width) * height;
+        bool full = width != previousWidth || height != previousHeight || previous.size() != pixels;
+        if (current.size() != pixels) current.resize(pixels);
+        if (full) previous.assign(pixels, 0);
+        previousWidth = width;
+        previousHeight = height;
+
+        int blocksX = (width + BlockSize - 1) / BlockSize;
+        int bands = (height + BlockSize - 1) / BlockSize;
+        if (static_cast<int>(bandData.size()) < bands) {
+            bandData.resize(bands);
+            bandBlocks.resize(bands);
+        }
+        pool.parallelFor(bands, [&](int band) {
+            int y0 = band * BlockSize;
+            int y1 = std::min(y0 + BlockSize, height);
+            fb.copyRowsToLinear(y0, y1, current.data(), width * 4);
+            std::vector<uint8_t>& out = bandData[band];
+            out.clear();
+            bandBlocks[band] = 0;
+            for (int bx = 0; bx < blocksX; ++bx) {
+                int x0 = bx * BlockSize;
+                int w = std::min(BlockSize, width - x0);
+                if (!full && !blockChanged(x0, y0, w, y1 - y0, width)) continue;
+                size_t header = out.size();
+                out.resize(header + 8);
+                BlockCodec::encode(&current[static_cast<size_t>(y0) * width + x0], width, w, y1 - y0, out);
+                InputEvent::put16(&out[header], static_cast<uint16_t>(bx));
+                InputEvent::put16(&out[header + 2], static_cast<uint16_t>(band));
+                InputEvent::put32(&out[header + 4], static_cast<uint32_t>(out.size() - header - 8));
+                ++bandBlocks[band];
+            }
+        });
+        current.swap(previous);
+
+        uint32_t blocks = 0;
+        size_t payload = 0;
+        for (int band = 0; band < bands; ++band) {
+            blocks += bandBlocks[band];
+            payload += bandData[band].size();
+        }
+        uint8_t header[16] = { 'S', 'R', 'T', 'F' };
+        InputEvent::put16(header + 4, static_cast<uint16_t>(width));
+        InputEvent::put16(header + 6, static_cast<uint16_t>(height));
+        InputEvent::put32(header + 8, blocks);
+        InputEvent::put32(header + 12, static_cast<uint32_t>(payload));
+        bool sent = client.sendAll(header, sizeof(header));
+        for (int band = 0; band < bands && sent; ++band) {
+            if (!bandData[band].empty()) sent = client.sendAll(bandData[band].data(), bandData[band].size());
+        }
+        if (!sent) client.close();
+        lastBlocks = blocks;
+        lastBytes = sizeof(header) + payload;
+        return sent;
+    }
+
+    uint32_t getLastBlocks() const { return lastBlocks; }
+    size_t getLastBytes() const { return lastBytes; }
+
+private:
+    bool blockChanged(int x0, int y0, int w, int h, int width) const {
+        for (int y = y0; y < y0 + h; ++y) {
+            size_t offset = static_cast<size_t>(y) * width + x0;
+            if (std::memcmp(&current[offset], &previous[offset], w * sizeof(uint32_t)) != 0) return true;
+        }
+        return false;
+    }
+
+    TcpSocket listener;
+    TcpSocket client;
+    std::vector<uint8_t> pending;
+    std::vector<uint32_t> current;
+    std::vector<uint32_t> previous;
+    int previousWidth = 0;
+    int previousHeight = 0;
+    std::vector<std::vector<uint8_t>> bandData;
+    std::vector<uint32_t> bandBlocks;
+    uint32_t lastBlocks = 0;
+    size_t lastBytes = 0;
+};
+
+// The viewer's end: keeps the full image and applies each frame's blocks.
+class FrameStreamClient {
+public:
+    bool connect(const char* host, int port) {
+        socket = TcpSocket::connect(host, port);
+        return socket.valid();
+    }
+
+    bool connected() const { return socket.valid(); }
+
+    bool sendInput(const InputEvent& event) {
+        uint8_t message[InputEvent::WireSize];
+        event.encode(message);
+        if (!socket.sendAll(message, sizeof(message))) socket.close();
+        return socket.valid();
+    }
+
+    // Waits up to timeoutMs for the next frame and applies it: 1 if a frame
+    // arrived, 0 on timeout and -1 if the connection is gone or the data is
+    // malformed.
+    int receiveFrame(int timeoutMs) {
+        if (!socket.valid()) return -1;
+        if (!socket.waitReadable(timeoutMs)) return 0;
+        uint8_t header[16];
+        if (!socket.receiveAll(header, sizeof(header)) || std::memcmp(header, "SRTF", 4) != 0) return fail();
+        int w = InputEvent::get16(header + 4);
+        int h = InputEvent::get16(header + 6);
+        uint32_t blocks = InputEvent::get32(header + 8);
+        uint32_t size = InputEvent::get32(header + 12);
+        if (w > FrameStreamServer::MaxSize || h > FrameStreamServer::MaxSize
+            || size > FrameStreamServer::maxPayload(w, h)) return fail();
+        payload.resize(size);
+        if (!payload.empty() && !socket.receiveAll(payload.data(), payload.size())) return fail();
+        if (w != width || h != height) {
+            width = w;
+            height = h;
+            pixels.assign(static_cast<size_t>(w) * h, 0xFF000000u);
+        }
+
+        const uint8_t* p = payload.data();
+        const uint8_t* end = p + payload.size();
+        const int blockSize = FrameStreamServer::BlockSize;
+        for (uint32_t i = 0; i < blocks; ++i) {
+            if (end - p < 8) return fail();
+            int x0 = InputEvent::get16(p) * blockSize;
+            int y0 = InputEvent::get16(p + 2) * blockSize;
+            uint32_t size = InputEvent::get32(p + 4);
+            p += 8;
+            if (x0 >= width || y0 >= height || static_cast<size_t>(end - p) < size) return fail();
+            int bw = std::min(blockSize, width - x0);
+            int bh = std::min(blockSize, height - y0);
+            if (!BlockCodec::decode(p, size, &pixels[static_cast<size_t>(y0) * width + x0], width, bw, bh)) return fail();
+            p += size;
+        }
+        return 1;
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    const uint32_t* getPixels() const { return pixels.data(); }
+
+private:
+    int fail() {
+        socket.close();
+        return -1;
+    }
+
+    TcpSocket socket;
+    std::vector<uint8_t> payload;
+    std::vector<uint32_t> pixels;
+    int width = 0;
+    int height = 0;
+};
@@ -0,0 +1,333 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SRT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+inline uint32_t packColor(int r, int g, int b) {
+    return 0xFF000000u | (static_cast<uint32_t>(r) << 16) | (static_cast<uint32_t>(g) << 8) | static_cast<uint32_t>(b);
+}
+
+// Source-over blend with alpha in [0, 255]; red and blue are blended in one
+// multiply by keeping them in separate 16-bit lanes.
+inline uint32_t blendColor(uint32_t dst, uint32_t src, int alpha) {
+    uint32_t a = static_cast<uint32_t>(alpha + (alpha >> 7));
+    uint32_t rb = ((src & 0x00FF00FFu) * a + (dst & 0x00FF00FFu) * (256 - a)) >> 8;
+    uint32_t g = ((src & 0x0000FF00u) * a + (dst & 0x0000FF00u) * (256 - a)) >> 8;
+    return 0xFF000000u | (rb & 0x00FF00FFu) | (g & 0x0000FF00u);
+}
+
+#ifdef SRT_SSE2
+// Operands of blendColor() for one colour and alpha, spread to 16-bit
+// channels so four pixels can be blended at once.
+struct SpanBlend {
+    __m128i source;
+    __m128i inverseAlpha;
+
+    SpanBlend(uint32_t color, int alpha) {
+        int a = alpha + (alpha >> 7);
+        __m128i c = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(color)), _mm_setzero_si128());
+        source = _mm_mullo_epi16(_mm_unpacklo_epi64(c, c), _mm_set1_epi16(static_cast<short>(a)));
+        inverseAlpha = _mm_set1_epi16(static_cast<short>(256 - a));
+    }
+
+    // Same rounding as blendColor(); the sums stay below 2^16.
+    __m128i apply(__m128i dst) const {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), inverseAlpha), source);
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), inverseAlpha), source);
+        __m128i out = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+        return _mm_or_si128(out, _mm_set1_epi32(static_cast<int>(0xFF000000u)));
+    }
+};
+
+// blendColor() on four pixels, each with its own alpha in a 32-bit lane.
+inline __m128i blendColor4(__m128i dst, uint32_t color, __m128i alpha) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(256);
+    alpha = _mm_add_epi32(alpha, _mm_srli_epi32(alpha, 7));
+    __m128i pairs = _mm_unpacklo_epi16(_mm_packs_epi32(alpha, alpha), _mm_packs_epi32(alpha, alpha));
+    __m128i alphaLo = _mm_unpacklo_epi32(pairs, pairs);
+    __m128i alphaHi = _mm_unpackhi_epi32(pairs, pairs);
+    __m128i source = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(color)), zero);
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(source, alphaLo),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_sub_epi16(full, alphaLo)));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(source, alphaHi),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_sub_epi16(full, alphaHi)));
+    __m128i out = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+    return _mm_or_si128(out, _mm_set1_epi32(static_cast<int>(0xFF000000u)));
+}
+#endif
+
+// ARGB8888 framebuffer stored as 8x8 tiles, tiles row-major across the image
+// and pixels in Morton (Z) order inside each tile. A steep line then walks
+// through a handful of 256-byte tiles instead of touching a new cache line
+// on every row. copyRowsToLinear() de-swizzles into a row-major target such
+// as a locked streaming texture.
+class TiledFramebuffer {
+public:
+    static const int TileShift = 3;
+    static const int TileSize = 1 << TileShift;
+    static const int TilePixels = TileSize * TileSize;
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        tilesX = (w + TileSize - 1) >> TileShift;
+        tilesY = (h + TileSize - 1) >> TileShift;
+        pixels.assign(static_cast<size_t>(tilesX) * tilesY * TilePixels, 0);
+
+        columnOffsets.resize(w);
+        for (int x = 0; x < w; ++x) {
+            columnOffsets[x] = static_cast<uint32_t>((x >> TileShift) * TilePixels) + mortonInTile(x & (TileSize - 1), 0);
+        }
+        rowOffsets.resize(h);
+        for (int y = 0; y < h; ++y) {
+            rowOffsets[y] = static_cast<size_t>(y >> TileShift) * tilesX * TilePixels + mortonInTile(0, y & (TileSize - 1));
+        }
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int tileRows() const { return tilesY; }
+
+    // The x and y bits of a Morton index never overlap, so the offset splits
+    // into a per-column and a per-row term that are looked up and added.
+    size_t index(int x, int y) const {
+        return rowOffsets[y] + columnOffsets[x];
+    }
+
+    uint32_t& at(int x, int y) { return pixels[index(x, y)]; }
+    uint32_t at(int x, int y) const { return pixels[index(x, y)]; }
+
+    // Tile rows are contiguous, so clearing a band is one fill.
+    void clearRows(int y0, int y1, uint32_t color) {
+        size_t begin = static_cast<size_t>(y0 >> TileShift) * tilesX * TilePixels;
+        size_t end = static_cast<size_t>((y1 + TileSize - 1) >> TileShift) * tilesX * TilePixels;
+        std::fill(pixels.begin() + begin, pixels.begin() + end, color);
+    }
+
+    // Blends color over pixels [x0, x1) of row y. Inside a tile a row is
+    // four pairs of adjacent pixels, so whole tile rows go four pixels per
+    // blend as two 64-bit halves.
+    void blendSpan(int x0, int x1, int y, uint32_t color, int alpha) {
+        uint32_t* row = &pixels[rowOffsets[y]];
+        int x = x0;
+#ifdef SRT_SSE2
+        if (x1 - x0 >= TileSize) {
+            for (; x & (TileSize - 1); ++x) row[columnOffsets[x]] = blendColor(row[columnOffsets[x]], color, alpha);
+            SpanBlend blend(color, alpha);
+            for (; x + TileSize <= x1; x += TileSize) {
+                uint32_t* p = row + (x >> TileShift) * TilePixels;
+                for (int half = 0; half < 2; ++half, p += 16) {
+                    __m128i d = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+                        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 4)));
+                    d = blend.apply(d);
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(p), d);
+                    _mm_storel_epi64(reinterpret_cast<__m128i*>(p + 4), _mm_unpackhi_epi64(d, d));
+                }
+            }
+        }
+#endif
+        for (; x < x1; ++x) row[columnOffsets[x]] = blendColor(row[columnOffsets[x]], color, alpha);
+    }
+
+#ifdef SRT_SSE2
+    // Blends pixels x to x + 3 of row y, x a multiple of four, each with its
+    // own alpha. They are two adjacent pairs in one tile row; columns past
+    // the width are tile padding, so a quad never needs clipping.
+    void blendQuad(int x, int y, uint32_t color, __m128i alpha) {
+        uint32_t* p = &pixels[rowOffsets[y] + columnOffsets[x]];
+        __m128i d = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 4)));
+        d = blendColor4(d, color, alpha);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), d);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p + 4), _mm_unpackhi_epi64(d, d));
+    }
+#endif
+
+    void copyRowsToLinear(int y0, int y1, void* dst, int pitch) const {
+        for (int tileY = y0 >> TileShift; tileY < ((y1 + TileSize - 1) >> TileShift); ++tileY) {
+            for (int tileX = 0; tileX < tilesX; ++tileX) {
+                const uint32_t* tile = &pixels[(static_cast<size_t>(tileY) * tilesX + tileX) * TilePixels];
+                int px = tileX << TileShift;
+                int py = tileY << TileShift;
+                unsigned char* out = static_cast<unsigned char*>(dst) + static_cast<size_t>(py) * pitch + px * 4;
+                if (px + TileSize <= width && py + TileSize <= height) {
+                    deswizzleTile(tile, out, pitch);
+                }
+                else {
+                    deswizzlePartialTile(tile, out, pitch, width - px, height - py);
+                }
+            }
+        }
+    }
+
+private:
+    static uint32_t mortonInTile(int x, int y) {
+        static const uint8_t spread[TileSize] = { 0, 1, 4, 5, 16, 17, 20, 21 };
+        return spread[x] | (spread[y] << 1);
+    }
+
+    // An 8x8 Morton tile is four 4x4 blocks of four 2x2 quads. Each quad is
+    // one 128-bit load, and two quads side by side give two 4-pixel rows via
+    // 64-bit unpacks.
+    static void deswizzleTile(const uint32_t* tile, unsigned char* out, int pitch) {
+#ifdef SRT_SSE2
+        for (int block = 0; block < 4; ++block) {
+            const __m128i* q = reinterpret_cast<const __m128i*>(tile + block * 16);
+            __m128i q0 = _mm_loadu_si128(q + 0);
+            __m128i q1 = _mm_loadu_si128(q + 1);
+            __m128i q2 = _mm_loadu_si128(q + 2);
+            __m128i q3 = _mm_loadu_si128(q + 3);
+            unsigned char* row = out + (block >> 1) * 4 * pitch + (block & 1) * 16;
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row), _mm_unpacklo_epi64(q0, q1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row + pitch), _mm_unpackhi_epi64(q0, q1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row + 2 * pitch), _mm_unpacklo_epi64(q2, q3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row + 3 * pitch), _mm_unpackhi_epi64(q2, q3));
+        }
+#else
+        deswizzlePartialTile(tile, out, pitch, TileSize, TileSize);
+#endif
+    }
+
+    static void deswizzlePartialTile(const uint32_t* tile, unsigned char* out, int pitch, int w, int h) {
+        if (w > TileSize) w = TileSize;
+        if (h > TileSize) h = TileSize;
+        for (int y = 0; y < h; ++y) {
+            uint32_t* row = reinterpret_cast<uint32_t*>(out + static_cast<size_t>(y) * pitch);
+            for (int x = 0; x < w; ++x) row[x] = tile[mortonInTile(x, y)];
+        }
+    }
+
+    int width = 0;
+    int height = 0;
+    int tilesX = 0;
+    int tilesY = 0;
+    std::vector<uint32_t> pixels;
+    std::vector<uint32_t> columnOffsets;
+    std::vector<size_t> rowOffsets;
+};
+
+// Plain row-major framebuffer with the same interface, kept as the baseline
+// for --bench-framebuffer.
+class LinearFramebuffer {
+public:
+    static const int TileSize = 8;
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        pixels.assign(static_cast<size_t>(w) * h, 0);
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int tileRows() const { return (height + TileSize - 1) / TileSize; }
+
+    size_t index(int x, int y) const { return static_cast<size_t>(y) * width + x; }
+    uint32_t& at(int x, int y) { return pixels[index(x, y)]; }
+    uint32_t at(int x, int y) const { return pixels[index(x, y)]; }
+
+    void clearRows(int y0, int y1, uint32_t color) {
+        if (y1 > height) y1 = height;
+        std::fill(pixels.begin() + index(0, y0), pixels.begin() + index(0, y1), color);
+    }
+
+    void blendSpan(int x0, int x1, int y, uint32_t color, int alpha) {
+        uint32_t* row = &pixels[index(0, y)];
+        int x = x0;
+#ifdef SRT_SSE2
+        SpanBlend blend(color, alpha);
+        for (; x + 4 <= x1; x += 4) {
+            __m128i* p = reinterpret_cast<__m128i*>(row + x);
+            _mm_storeu_si128(p, blend.apply(_mm_loadu_si128(p)));
+        }
+#endif
+        for (; x < x1; ++x) row[x] = blendColor(row[x], color, alpha);
+    }
+
+#ifdef SRT_SSE2
+    void blendQuad(int x, int y, uint32_t color, __m128i alpha) {
+        uint32_t* p = &pixels[index(x, y)];
+        if (x + 4 <= width) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), blendColor4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), color, alpha));
+            return;
+        }
+        alignas(16) int lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), alpha);
+        for (int l = 0; x + l < width; ++l) p[l] = blendColor(p[l], color, lanes[l]);
+    }
+#endif
+
+    void copyRowsToLinear(int y0, int y1, void* dst, int pitch) const {
+        if (y1 > height) y1 = height;
+        for (int y = y0; y < y1; ++y) {
+            std::memcpy(static_cast<unsigned char*>(dst) + static_cast<size_t>(y) * pitch,
+                &pixels[index(0, y)], static_cast<size_t>(width) * 4);
+        }
+    }
+
+private:
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> pixels;
+};
+
+// Alpha-blends the segment (x0, y0)-(x1, y1) into rows [yMin, yMax) of fb.
+// Pixel positions come from one fixed-point DDA over the whole segment, so
+// bands drawn by different threads meet without gaps or overlap.
+template <typename Framebuffer>
+void blendLine(Framebuffer& fb, int x0, int y0, int x1, int y1, uint32_t color, int alpha, int yMin, int yMax) {
+    if (yMin < 0) yMin = 0;
+    if (yMax > fb.getHeight()) yMax = fb.getHeight();
+    if ((y0 < yMin && y1 < yMin) || (y0 >= yMax && y1 >= yMax)) return;
+
+    int dx = x1 - x0;
+    int dy = y1 - y0;
+    int steps = std::abs(dx) > std::abs(dy) ? std::abs(dx) : std::abs(dy);
+    if (steps == 0) {
+        if (x0 >= 0 && x0 < fb.getWidth()) fb.at(x0, y0) = blendColor(fb.at(x0, y0), color, alpha);
+        return;
+    }
+
+    int64_t stepX = static_cast<int64_t>(dx) * 65536 / steps;
+    int64_t stepY = static_cast<int64_t>(dy) * 65536 / steps;
+
+    // Restrict the step range to the band and the image width, with a pixel
+    // of slack for rounding; the per-pixel test below is exact.
+    int first = 0;
+    int last = steps;
+    if (dy != 0) {
+        int a = static_cast<int>((static_cast<int64_t>(yMin - 1 - y0) * steps) / dy);
+        int b = static_cast<int>((static_cast<int64_t>(yMax + 1 - y0) * steps) / dy);
+        if (a > b) { int t = a; a = b; b = t; }
+        if (a > first) first = a;
+        if (b < last) last = b;
+    }
+    if (dx != 0) {
+        int a = static_cast<int>((static_cast<int64_t>(-1 - x0) * steps) / dx);
+        int b = static_cast<int>((static_cast<int64_t>(fb.getWidth() + 1 - x0) * steps) / dx);
+        if (a > b) { int t = a; a = b; b = t; }
+        if (a > first) first = a;
+        if (b < last) last = b;
+    }
+
+    int64_t fx = static_cast<int64_t>(x0) * 65536 + 0x8000 + stepX * first;
+    int64_t fy = static_cast<int64_t>(y0) * 65536 + 0x8000 + stepY * first;
+    for (int i = first; i <= last; ++i, fx += stepX, fy += stepY) {
+        int x = static_cast<int>(fx >> 16);
+        int y = static_cast<int>(fy >> 16);
+        if (y < yMin || y >= yMax || x < 0 || x >= fb.getWidth()) continue;
+        uint32_t& p = fb.at(x, y);
+        p = blendColor(p, color, alpha);
+    }
+}
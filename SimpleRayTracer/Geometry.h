@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "Vec2.h"
+
+struct Circle {
+    Vec2 center;
+    float radius;
+};
+
+struct Aabb {
+    Vec2 min, max;
+
+    Aabb() : min(1e30f, 1e30f), max(-1e30f, -1e30f) {}
+    Aabb(const Vec2& min, const Vec2& max) : min(min), max(max) {}
+
+    static Aabb around(const Vec2& center, float radius) {
+        return Aabb(Vec2(center.x - radius, center.y - radius), Vec2(center.x + radius, center.y + radius));
+    }
+
+    void grow(const Aabb& b) {
+        min = Vec2(std::min(min.x, b.min.x), std::min(min.y, b.min.y));
+        max = Vec2(std::max(max.x, b.max.x), std::max(max.y, b.max.y));
+    }
+
+    bool overlaps(const Aabb& b) const {
+        return min.x <= b.max.x && b.min.x <= max.x && min.y <= b.max.y && b.min.y <= max.y;
+    }
+
+    Vec2 center() const { return Vec2((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f); }
+    Vec2 extent() const { return max - min; }
+    float perimeter() const { return 2.0f * ((max.x - min.x) + (max.y - min.y)); }
+};
+
+inline Aabb boundsOf(const Circle& c) {
+    return Aabb::around(c.center, c.radius);
+}
+
+// Morton code of a cell: the low 16 bits of x on the even bits, of y on the
+// odd ones.
+inline uint32_t mortonCode(uint32_t x, uint32_t y) {
+    auto spread = [](uint32_t v) {
+        v &= 0xffffu;
+        v = (v | v << 8) & 0x00ff00ffu;
+        v = (v | v << 4) & 0x0f0f0f0fu;
+        v = (v | v << 2) & 0x33333333u;
+        return (v | v << 1) & 0x55555555u;
+    };
+    return spread(x) | spread(y) << 1;
+}
+
+// Nearest hit of the ray origin + dir * t with the circle for t > 0.001.
+// dir does not need to be normalised.
+inline bool intersectCircle(const Circle& circle, const Vec2& rayOrigin, const Vec2& rayDir, float& t) {
+    Vec2 oc = rayOrigin - circle.center;
+    float a = rayDir.x * rayDir.x + rayDir.y * rayDir.y;
+    float b = 2.0f * (oc.x * rayDir.x + oc.y * rayDir.y);
+    float c = oc.x * oc.x + oc.y * oc.y - circle.radius * circle.radius;
+    float discriminant = b * b - 4 * a * c;
+
+    if (discriminant < 0) return false;
+
+    t = (-b - std::sqrt(discriminant)) / (2.0f * a);
+    return t > 0.001f;
+}
+
+// Slab test against a box, with the reciprocal direction precomputed.
+inline bool intersectAabb(const Aabb& box, const Vec2& rayOrigin, const Vec2& invDir, float tMax, float& tEntry) {
+    float tx1 = (box.min.x - rayOrigin.x) * invDir.x;
+    float tx2 = (box.max.x - rayOrigin.x) * invDir.x;
+    float ty1 = (box.min.y - rayOrigin.y) * invDir.y;
+    float ty2 = (box.max.y - rayOrigin.y) * invDir.y;
+    float tNear = std::max(std::min(tx1, tx2), std::min(ty1, ty2));
+    float tFar = std::min(std::max(tx1, tx2), std::max(ty1, ty2));
+    tEntry = tNear;
+    return tFar >= std::max(tNear, 0.0f) && tNear <= tMax;
+}
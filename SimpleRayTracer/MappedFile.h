@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstddef>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A whole file mapped read-only, so its pages are read in by the OS as they
+// are touched instead of through a read buffer. Move-only.
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(MappedFile&& other) { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) {
+        if (this != &other) {
+            close();
+            data = other.data;
+            size = other.size;
+#ifdef _WIN32
+            file = other.file;
+            mapping = other.mapping;
+            other.file = INVALID_HANDLE_VALUE;
+            other.mapping = nullptr;
+#endif
+            other.data = nullptr;
+            other.size = 0;
+        }
+        return *this;
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    // Invalid if the file is missing or empty.
+    static MappedFile open(const char* path) {
+        MappedFile mapped;
+#ifdef _WIN32
+        mapped.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (mapped.file == INVALID_HANDLE_VALUE) return mapped;
+        LARGE_INTEGER length;
+        if (!GetFileSizeEx(mapped.file, &length) || length.QuadPart == 0) {
+            mapped.close();
+            return mapped;
+        }
+        mapped.mapping = CreateFileMappingA(mapped.file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapped.mapping) mapped.data = MapViewOfFile(mapped.mapping, FILE_MAP_READ, 0, 0, 0);
+        if (mapped.data) mapped.size = static_cast<size_t>(length.QuadPart);
+        else mapped.close();
+#else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return mapped;
+        struct stat status;
+        if (fstat(fd, &status) == 0 && status.st_size > 0) {
+            size_t size = static_cast<size_t>(status.st_size);
+            void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                mapped.data = p;
+                mapped.size = size;
+            }
+        }
+        ::close(fd);
+#endif
+        return mapped;
+    }
+
+    bool valid() const { return data != nullptr; }
+    const void* get() const { return data; }
+    size_t getSize() const { return size; }
+
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data) munmap(data, size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
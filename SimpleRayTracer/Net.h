@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+// Blocking TCP socket with just what the frame stream and the ray query
+// service need. Waiting is done with select() and a timeout, and sendSome()
+// never blocks, so a loop can poll without making the socket non-blocking.
+// Move-only; the socket is closed on destruction.
+class TcpSocket {
+public:
+#ifdef _WIN32
+    typedef SOCKET Handle;
+    static const Handle Invalid = INVALID_SOCKET;
+#else
+    typedef int Handle;
+    static const Handle Invalid = -1;
+#endif
+
+    TcpSocket() {}
+    explicit TcpSocket(Handle handle) : handle(handle) {}
+    TcpSocket(TcpSocket&& other) : handle(other.handle) { other.handle = Invalid; }
+    TcpSocket& operator=(TcpSocket&& other) {
+        if (this != &other) {
+            close();
+            handle = other.handle;
+            other.handle = Invalid;
+        }
+        return *this;
+    }
+    TcpSocket(const TcpSocket&) = delete;
+    TcpSocket& operator=(const TcpSocket&) = delete;
+    ~TcpSocket() { close(); }
+
+    bool valid() const { return handle != Invalid; }
+
+    void close() {
+        if (handle == Invalid) return;
+#ifdef _WIN32
+        closesocket(handle);
+#else
+        ::close(handle);
+#endif
+        handle = Invalid;
+    }
+
+    // Listens on address:port; address is a numeric IPv4 address.
+    static TcpSocket listen(const char* address, int port) {
+        if (!startup()) return TcpSocket();
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<unsigned short>(port));
+        if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) return TcpSocket();
+        TcpSocket socket(::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP));
+        if (!socket.valid()) return socket;
+        int reuse = 1;
+        setsockopt(socket.handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+        if (bind(socket.handle, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0
+            || ::listen(socket.handle, SOMAXCONN) != 0) {
+            socket.close();
+        }
+        return socket;
+    }
+
+    static TcpSocket connect(const char* host, int port) {
+        if (!startup()) return TcpSocket();
+        char service[16];
+        std::snprintf(service, sizeof(service), "%d", port);
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* results = nullptr;
+        if (getaddrinfo(host, service, &hints, &results) != 0) return TcpSocket();
+        TcpSocket socket;
+        for (addrinfo* a = results; a && !socket.valid(); a = a->ai_next) {
+            socket = TcpSocket(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+            if (socket.valid() && ::connect(socket.handle, a->ai_addr, static_cast<int>(a->ai_addrlen)) != 0) socket.close();
+        }
+        freeaddrinfo(results);
+        if (socket.valid()) socket.setNoDelay();
+        return socket;
+    }
+
+    // Waits up to timeoutMs for a connection on a listening socket.
+    TcpSocket accept(int timeoutMs) {
+        if (!waitReadable(timeoutMs)) return TcpSocket();
+        TcpSocket client(::accept(handle, nullptr, nullptr));
+        if (client.valid()) client.setNoDelay();
+        return client;
+    }
+
+    bool sendAll(const void* data, size_t size) {
+        const char* p = static_cast<const char*>(data);
+        while (size > 0) {
+            int sent = static_cast<int>(::send(handle, p, static_cast<int>(size < 1 << 30 ? size : 1 << 30), sendFlags));
+            if (sent <= 0) return false;
+            p += sent;
+            size -= static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    // Sends as much of data as the socket takes without blocking: the byte
+    // count, 0 when its buffer is full, or -1 when the connection is broken.
+    int sendSome(const void* data, size_t size) {
+        int length = static_cast<int>(size < 1 << 30 ? size : 1 << 30);
+#ifdef _WIN32
+        u_long on = 1, off = 0;
+        ioctlsocket(handle, FIONBIO, &on);
+        int sent = ::send(handle, static_cast<const char*>(data), length, 0);
+        bool full = sent < 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+        ioctlsocket(handle, FIONBIO, &off);
+#else
+        int sent = static_cast<int>(::send(handle, data, length, sendFlags | MSG_DONTWAIT));
+        bool full = sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+#endif
+        if (sent >= 0) return sent;
+        return full ? 0 : -1;
+    }
+
+    bool receiveAll(void* data, size_t size) {
+        char* p = static_cast<char*>(data);
+        while (size > 0) {
+            int received = static_cast<int>(::recv(handle, p, static_cast<int>(size < 1 << 30 ? size : 1 << 30), 0));
+            if (received <= 0) return false;
+            p += received;
+            size -= static_cast<size_t>(received);
+        }
+        return true;
+    }
+
+    // Whatever has arrived, up to size bytes, after waiting at most
+    // timeoutMs for the first of it: the byte count, 0 on timeout, or -1
+    // when the connection is closed.
+    int receiveSome(void* data, size_t size, int timeoutMs) {
+        if (!waitReadable(timeoutMs)) return 0;
+        int received = static_cast<int>(::recv(handle, static_cast<char*>(data), static_cast<int>(size), 0));
+        return received > 0 ? received : -1;
+    }
+
+    bool waitReadable(int timeoutMs) {
+        fd_set set;
+        FD_ZERO(&set);
+        FD_SET(handle, &set);
+        timeval timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        return select(static_cast<int>(handle + 1), &set, nullptr, nullptr, &timeout) > 0;
+    }
+
+    // Waits up to timeoutMs until any of the count sockets is readable and
+    // sets readable[i] for each one that is; returns how many are.
+    static int waitAnyReadable(TcpSocket* const* sockets, int count, int timeoutMs, bool* readable) {
+        return waitAny(sockets, count, timeoutMs, nullptr, nullptr, readable, nullptr);
+    }
+
+    // The same for sockets[i] readable, if watchRead[i], or writable, if
+    // watchWrite[i]; a null watchRead watches every socket for reading, a
+    // null watchWrite none for writing.
+    static int waitAny(TcpSocket* const* sockets, int count, int timeoutMs, const bool* watchRead,
+        const bool* watchWrite, bool* readable, bool* writable) {
+        fd_set readSet, writeSet;
+        FD_ZERO(&readSet);
+        FD_ZERO(&writeSet);
+        Handle highest = 0;
+        for (int i = 0; i < count; ++i) {
+            if (!watchRead || watchRead[i]) FD_SET(sockets[i]->handle, &readSet);
+            if (watchWrite && watchWrite[i]) FD_SET(sockets[i]->handle, &writeSet);
+            if (sockets[i]->handle > highest) highest = sockets[i]->handle;
+        }
+        timeval timeout;
+        timeout.tv_sec = timeoutMs / 1000;
+        timeout.tv_usec = (timeoutMs % 1000) * 1000;
+        int ready = select(static_cast<int>(highest + 1), &readSet, watchWrite ? &writeSet : nullptr, nullptr, &timeout);
+        for (int i = 0; i < count; ++i) {
+            readable[i] = ready > 0 && FD_ISSET(sockets[i]->handle, &readSet);
+            if (writable) writable[i] = ready > 0 && watchWrite && FD_ISSET(sockets[i]->handle, &writeSet);
+        }
+        return ready > 0 ? ready : 0;
+    }
+
+private:
+    // Frames and input are small writes that should go out immediately.
+    void setNoDelay() {
+        int on = 1;
+        setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+    }
+
+    static bool startup() {
+#ifdef _WIN32
+        static bool started = [] {
+            WSADATA data;
+            return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+        }();
+        return started;
+#else
+        return true;
+#endif
+    }
+
+#ifdef MSG_NOSIGNAL
+    // A viewer that disconnects mid-frame must not kill the server.
+    static const int sendFlags = MSG_NOSIGNAL;
+#else
+    static const int sendFlags = 0;
+#endif
+
+    Handle handle = Invalid;
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Bvh.h"
+#include "Geometry.h"
+
+// Pyramid of bitmaps over the scene: a bit of level 0 is set when geometry
+// overlaps that cell, and a bit of level k + 1 is the OR of the 2x2 bits
+// below it. The pyramid is flattened into one byte per level 0 cell, the
+// coarsest level at which the cell's ancestor is still empty, so a ray
+// walking the grid steps over the largest empty aligned block it is in
+// with one lookup and never descends: a ray through open space is rejected
+// in a few steps without touching the BVH. Cells are marked from circle
+// bounds grown by a little more than the walk's step past each cell edge,
+// which keeps the walk conservative.
+//
+// LOD proxies can lie outside their members' cells, so rays traced with LOD
+// walk a second map in which circles are grown by a quarter cell more. A
+// proxy accepted at error e = maxErrorPixels / pixelsPerUnit lies within
+// its node's bounds, at most e across, grown by its radius of at most e / 2,
+// so within 1.5e of every member; while that fits in the quarter cell the
+// map covers it, and otherwise rays go straight to the BVH.
+//
+// The map is switched off for scenes that fill more than MaxOccupied of it,
+// where the wide BVH already rejects rays through the gaps as fast as the
+// walk, and for scenes under MinCircles, whose BVH is shallow enough to
+// reject a ray as fast as the walk.
+class OccupancyMap {
+public:
+    // Level 0 cells are about twice the mean circle diameter, with at most
+    // MaxResolution of them along the longer side of the scene.
+    static const int MaxResolution = 2048;
+    static const size_t MinCircles = 512;
+    static constexpr float MaxOccupied = 0.05f;
+
+    void build(const std::vector<Circle>& circles) {
+        exact.clear();
+        dilated.clear();
+        width = height = 0;
+        active = false;
+        if (circles.empty()) return;
+
+        Aabb bounds;
+        float diameters = 0.0f;
+        for (const Circle& circle : circles) {
+            bounds.grow(boundsOf(circle));
+            diameters += 2.0f * circle.radius;
+        }
+        Vec2 extent = bounds.extent();
+        float longest = std::max(std::max(extent.x, extent.y), 1e-3f);
+        cellSize = std::max(2.0f * diameters / circles.size(), longest / MaxResolution);
+        invCellSize = 1.0f / cellSize;
+        gridMin = bounds.min - Vec2(cellSize, cellSize);
+
+        width = static_cast<int>(std::ceil(extent.x * invCellSize)) + 2;
+        height = static_cast<int>(std::ceil(extent.y * invCellSize)) + 2;
+        size_t occupied = build(circles, 2 * Nudge, exact);
+        build(circles, LodMargin + 2 * Nudge, dilated);
+        fraction = static_cast<float>(occupied) / (static_cast<float>(width) * height);
+        active = fraction <= MaxOccupied && circles.size() >= MinCircles;
+    }
+
+    bool isActive() const { return active; }
+    float occupiedFraction() const { return fraction; }
+    float getCellSize() const { return cellSize; }
+
+    // False only when nothing along origin + dir * t, t in [0, tMax], can
+    // be hit; true means the BVH has to answer.
+    bool mayHit(const Vec2& origin, const Vec2& dir, float tMax, const LodSettings* lod) const {
+        if (!active) return !exact.empty();
+        if (lod && 1.5f * lod->maxErrorPixels > lod->pixelsPerUnit * LodMargin * cellSize) return true;
+        if (dir.x == 0.0f && dir.y == 0.0f) return true;
+        const uint8_t* empty = lod ? dilated.data() : exact.data();
+
+        // In grid units, clipped to the grid.
+        Vec2 g = (origin - gridMin) * invCellSize;
+        Vec2 d = dir * invCellSize;
+        float t0 = 0.0f, t1 = tMax;
+        if (!clip(g.x, d.x, static_cast<float>(width), t0, t1)
+            || !clip(g.y, d.y, static_cast<float>(height), t0, t1)) return false;
+
+        // Out through the far edges of the empty block: the edge is at
+        // (cell + 1) << level going up and cell << level going down.
+        Vec2 inv(1.0f / d.x, 1.0f / d.y);
+        int aheadX = d.x > 0, aheadY = d.y > 0;
+        const float nudge = Nudge / std::max(std::abs(d.x), std::abs(d.y));
+        float t = t0;
+        while (t <= t1) {
+            int x = std::min(std::max(static_cast<int>(g.x + d.x * t), 0), width - 1);
+            int y = std::min(std::max(static_cast<int>(g.y + d.y * t), 0), height - 1);
+            int level = empty[static_cast<size_t>(y) * width + x];
+            if (level == Occupied) return true;
+            float tx = d.x != 0 ? (static_cast<float>(((x >> level) + aheadX) << level) - g.x) * inv.x : t1 + 1.0f;
+            float ty = d.y != 0 ? (static_cast<float>(((y >> level) + aheadY) << level) - g.y) * inv.y : t1 + 1.0f;
+            t = std::max(std::min(tx, ty), t) + nudge;
+        }
+        return false;
+    }
+
+private:
+    friend class AcceleratorCache;
+
+    // How far past a cell edge, in cells, the walk steps to be sure it is
+    // in the next cell.
+    static constexpr float Nudge = 1e-3f;
+    static constexpr float LodMargin = 0.25f;
+
+    static const uint8_t Occupied = 0xff;
+
+    struct Level {
+        int width = 0;
+        int height = 0;
+        int wordsPerRow = 0;
+        std::vector<uint64_t> bits;
+
+        void resize(int w, int h) {
+            width = w;
+            height = h;
+            wordsPerRow = (w + 63) / 64;
+            // An even word count lets the level above take them in pairs.
+            wordsPerRow += wordsPerRow % 2;
+            bits.assign(static_cast<size_t>(wordsPerRow) * h, 0);
+        }
+
+        bool test(int x, int y) const {
+            return (bits[static_cast<size_t>(y) * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+        }
+
+        void setRun(int x0, int x1, int y) {
+            uint64_t* row = &bits[static_cast<size_t>(y) * wordsPerRow];
+            for (int w = x0 >> 6; w <= x1 >> 6; ++w) {
+                int from = std::max(x0 - w * 64, 0);
+                int to = std::min(x1 - w * 64, 63);
+                uint64_t upper = to == 63 ? ~0ull : (2ull << to) - 1;
+                row[w] |= upper & ~((1ull << from) - 1);
+            }
+        }
+    };
+
+    // Marks every cell within margin cells of a circle's bounds, ORs the
+    // pyramid together and flattens it into empty. Returns how many cells
+    // are occupied.
+    size_t build(const std::vector<Circle>& circles, float margin, std::vector<uint8_t>& empty) {
+        std::vector<Level> levels(1);
+        Level& base = levels[0];
+        base.resize(width, height);
+        for (const Circle& circle : circles) {
+            Vec2 reach = Vec2(1, 1) * (circle.radius * invCellSize + margin);
+            Vec2 lo = (circle.center - gridMin) * invCellSize - reach;
+            Vec2 hi = (circle.center - gridMin) * invCellSize + reach;
+            int x0 = std::max(static_cast<int>(std::floor(lo.x)), 0);
+            int x1 = std::min(static_cast<int>(std::floor(hi.x)), base.width - 1);
+            int y0 = std::max(static_cast<int>(std::floor(lo.y)), 0);
+            int y1 = std::min(static_cast<int>(std::floor(hi.y)), base.height - 1);
+            for (int y = y0; y <= y1; ++y) base.setRun(x0, x1, y);
+        }
+
+        while (levels.back().width > 1 || levels.back().height > 1) {
+            levels.emplace_back();
+            const Level& below = levels[levels.size() - 2];
+            Level& level = levels.back();
+            level.resize((below.width + 1) / 2, (below.height + 1) / 2);
+            for (int y = 0; y < level.height; ++y) {
+                const uint64_t* row0 = &below.bits[static_cast<size_t>(2 * y) * below.wordsPerRow];
+                const uint64_t* row1 = 2 * y + 1 < below.height ? row0 + below.wordsPerRow : row0;
+                uint64_t* out = &level.bits[static_cast<size_t>(y) * level.wordsPerRow];
+                for (int w = 0; w < below.wordsPerRow; ++w) {
+                    uint64_t pairs = halve(row0[w] | row1[w]);
+                    out[w / 2] |= w % 2 ? pairs << 32 : pairs;
+                }
+            }
+        }
+
+        size_t occupied = 0;
+        int top = static_cast<int>(levels.size()) - 1;
+        empty.resize(static_cast<size_t>(width) * height);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                uint8_t& cell = empty[static_cast<size_t>(y) * width + x];
+                if (levels[0].test(x, y)) {
+                    cell = Occupied;
+                    ++occupied;
+                    continue;
+                }
+                int level = 0;
+                while (level < top && !levels[level + 1].test(x >> (level + 1), y >> (level + 1))) ++level;
+                cell = static_cast<uint8_t>(level);
+            }
+        }
+        return occupied;
+    }
+
+    // ORs each pair of adjacent bits and packs the 32 results into the low
+    // half of the word.
+    static uint64_t halve(uint64_t x) {
+        x = (x | x >> 1) & 0x5555555555555555ull;
+        x = (x | x >> 1) & 0x3333333333333333ull;
+        x = (x | x >> 2) & 0x0f0f0f0f0f0f0f0full;
+        x = (x | x >> 4) & 0x00ff00ff00ff00ffull;
+        x = (x | x >> 8) & 0x0000ffff0000ffffull;
+        return (x | x >> 16) & 0x00000000ffffffffull;
+    }
+
+    // Narrows [t0, t1] to where g + d * t is within [0, size] on one axis.
+    static bool clip(float g, float d, float size, float& t0, float& t1) {
+        if (d == 0.0f) return g >= 0.0f && g <= size;
+        float a = -g / d;
+        float b = (size - g) / d;
+        t0 = std::max(t0, std::min(a, b));
+        t1 = std::min(t1, std::max(a, b));
+        return t0 <= t1;
+    }
+
+    // Per level 0 cell, the coarsest empty level or Occupied.
+    std::vector<uint8_t> exact;
+    std::vector<uint8_t> dilated;
+    int width = 0;
+    int height = 0;
+    Vec2 gridMin;
+    float cellSize = 1.0f;
+    float invCellSize = 1.0f;
+    float fraction = 0.0f;
+    bool active = false;
+};
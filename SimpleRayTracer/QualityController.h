@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+
+// One rung of the quality ladder: rays traced per light and the fraction of
+// the output resolution the framebuffer is rendered at.
+struct QualityLevel {
+    int numRays;
+    float renderScale;
+};
+
+// Moves up and down a fixed ladder of quality levels to keep the smoothed
+// frame time near a target. Stepping down happens as soon as the average is
+// clearly over budget; stepping up needs it to stay well under budget, and
+// every change is followed by a cooldown so the new level's cost is measured
+// before the next decision. The gap between the two thresholds keeps the
+// controller from oscillating between neighbouring levels.
+class QualityController {
+public:
+    explicit QualityController(double targetMs = 8.0, float maxRenderScale = 1.0f)
+        : targetMs(targetMs), maxRenderScale(maxRenderScale) {}
+
+    bool enabled() const { return targetMs > 0; }
+    double getTargetMs() const { return targetMs; }
+    double getAverageMs() const { return averageMs; }
+
+    int getNumRays() const { return levels()[level].numRays; }
+    float getRenderScale() const { return std::min(levels()[level].renderScale, maxRenderScale); }
+
+    // Feeds in the time the last frame took; returns true if the level
+    // changed.
+    bool addFrame(double frameMs) {
+        if (!enabled()) return false;
+        averageMs = averageMs > 0 ? averageMs + (frameMs - averageMs) * smoothing : frameMs;
+        if (cooldown > 0) {
+            --cooldown;
+            return false;
+        }
+
+        if (averageMs > targetMs * 1.15 && level > 0) {
+            --level;
+        }
+        else if (averageMs < targetMs * 0.5 && level + 1 < levelCount) {
+            ++level;
+        }
+        else {
+            return false;
+        }
+        cooldown = cooldownFrames;
+        averageMs = 0;
+        return true;
+    }
+
+private:
+    static const int levelCount = 10;
+    static const int cooldownFrames = 20;
+    static constexpr double smoothing = 0.1;
+
+    // Each step changes either the ray count or the render scale, never
+    // both, and at most about doubles the work: scales go up by about
+    // sqrt(2), which doubles the pixels. A step up from half the budget
+    // lands within it.
+    static const QualityLevel* levels() {
+        static const QualityLevel table[levelCount] = {
+            { 60, 0.354f }, { 90, 0.354f }, { 90, 0.5f }, { 180, 0.5f }, { 180, 0.707f },
+            { 360, 0.707f }, { 360, 1.0f }, { 720, 1.0f }, { 1440, 1.0f }, { 2880, 1.0f },
+        };
+        return table;
+    }
+
+    double targetMs;
+    float maxRenderScale;
+    int level = 6;
+    int cooldown = cooldownFrames;
+    double averageMs = 0;
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Vec2.h"
+
+// Hit distances of one light's rays carried over from earlier frames. With an
+// accumulation factor of N, a frame traces the rays whose index is congruent
+// to the current phase mod N and takes the rest from history, so every ray is
+// refreshed at least once every N frames.
+//
+// When the light moves, stored hit points are reprojected into the angular
+// bins of the new position, nearest first. A reprojected point still lies on
+// an occluder (or, for a miss, at the end of an empty segment), so it can
+// only overestimate the new distance; the error comes from occluders that
+// are now in front. Rays nothing was reprojected into are
+// traced this frame, and a fresh ray that finds something nearer than its own
+// history rejects the history of its neighbourhood (the rays up to the next
+// fresh ray on either side), which is traced in a second pass.
+class RayHistory {
+public:
+    // Prepares for tracing numRays rays from origin at LOD scale lodScale (0
+    // without LOD); distances traced at another scale are dropped, as LOD
+    // proxies differ from one scale to the next. Returns true when every ray
+    // has to be traced this frame.
+    bool begin(const Vec2& origin, float radius, int numRays, int accumulation, float lodScale) {
+        accumulation = std::max(1, accumulation);
+        if (!valid || numRays != count() || radius != maxDistance || accumulation != factor || lodScale != scale) {
+            distances.assign(numRays, radius);
+            measured.assign(numRays, 1);
+            state.assign(numRays, Trace);
+            maxDistance = radius;
+            factor = accumulation;
+            scale = lodScale;
+            phase = 0;
+            position = origin;
+            valid = true;
+            return true;
+        }
+
+        phase = (phase + 1) % factor;
+        if (origin.x != position.x || origin.y != position.y) reproject(origin);
+        position = origin;
+
+        bool all = true;
+        for (int i = 0; i < count(); ++i) {
+            state[i] = factor == 1 || i % factor == phase || !measured[i] ? Trace : Keep;
+            all = all && state[i] == Trace;
+        }
+        return all;
+    }
+
+    bool needsTrace(int ray) const { return state[ray] == Trace; }
+    bool needsRetrace(int ray) const { return state[ray] == Rejected; }
+
+    // Records a traced ray. In the first pass, a distance clearly shorter
+    // than the history had for this ray rejects its neighbourhood.
+    void store(int ray, float distance) {
+        bool closer = measured[ray] && distance < distances[ray] * 0.98f - 0.5f;
+        distances[ray] = distance;
+        measured[ray] = 1;
+        if (closer && state[ray] == Trace) {
+            int n = count();
+            for (int k = 1; k < factor; ++k) {
+                int before = (ray - k + n) % n;
+                int after = (ray + k) % n;
+                if (state[before] == Keep) state[before] = Rejected;
+                if (state[after] == Keep) state[after] = Rejected;
+            }
+        }
+        state[ray] = Traced;
+    }
+
+    float distance(int ray) const { return distances[ray]; }
+    int count() const { return static_cast<int>(distances.size()); }
+
+private:
+    enum : uint8_t { Keep, Trace, Rejected, Traced };
+
+    // A miss moves as the far end of its ray and stays a miss. Rays at a
+    // silhouette are not carried over; bins nothing lands in are left
+    // unmeasured and get traced.
+    void reproject(const Vec2& origin) {
+        int n = count();
+        const float twoPi = 6.28318531f;
+        const float binsPerRadian = n / twoPi;
+        scratch.assign(n, maxDistance);
+        scratchMeasured.assign(n, 0);
+        for (int i = 0; i < n; ++i) {
+            float d = distances[i];
+            if (!measured[i] || silhouette(i)) continue;
+            float angle = twoPi * i / n;
+            Vec2 v = position + Vec2(std::cos(angle), std::sin(angle)) * d - origin;
+            float a = std::atan2(v.y, v.x);
+            if (a < 0) a += twoPi;
+            int bin = static_cast<int>(a * binsPerRadian + 0.5f);
+            if (bin >= n) bin -= n;
+            if (d < maxDistance) scratch[bin] = std::min(scratch[bin], std::min(v.length(), maxDistance));
+            scratchMeasured[bin] = 1;
+        }
+        distances.swap(scratch);
+        measured.swap(scratchMeasured);
+    }
+
+    // A ray next to a depth jump may have grazed an occluder; moved to a
+    // slightly different direction it could just as well miss it.
+    bool silhouette(int ray) const {
+        int n = count();
+        float d = distances[ray];
+        float tolerance = d * 0.05f + 1.0f;
+        return std::fabs(distances[(ray + n - 1) % n] - d) > tolerance ||
+               std::fabs(distances[(ray + 1) % n] - d) > tolerance;
+    }
+
+    std::vector<float> distances;
+    std::vector<float> scratch;
+    std::vector<uint8_t> measured;
+    std::vector<uint8_t> scratchMeasured;
+    std::vector<uint8_t> state;
+    Vec2 position;
+    float maxDistance = 0.0f;
+    int factor = 1;
+    float scale = 0.0f;
+    int phase = 0;
+    bool valid = false;
+};
@@ -0,0 +1,525 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Net.h"
+#include "RaySort.h"
+#include "Scene.h"
+#include "SharedMemory.h"
+#include "ThreadPool.h"
+
+// Batched ray queries against a scene kept in memory, over TCP.
+//
+// Request:  "SRTQ", u32 id, u32 kind, u32 count, then count records
+//     ClosestHit: origin x, y, direction x, y, tMax
+//     Visible:    from x, y, to x, y
+// Response: "SRTR", u32 id, u32 kind, u32 count, then
+//     ClosestHit: count floats, the hit's t along the direction or -1
+//     Visible:    (count + 7) / 8 bytes, bit i (lowest first) set when
+//                 nothing blocks segment i
+// Integers and floats are sent as they are in memory, so both ends must be
+// little-endian, as every platform this builds for is. Requests on one
+// connection are answered in order, so a client can keep several in
+// flight.
+namespace RayQuery {
+    enum Kind : uint32_t { ClosestHit = 0, Visible = 1 };
+
+    const size_t HeaderSize = 16;
+    // Bounds the memory a single request can make the server allocate.
+    const uint32_t MaxCount = 1u << 22;
+
+    inline size_t recordSize(uint32_t kind) { return kind == ClosestHit ? 5 * sizeof(float) : 4 * sizeof(float); }
+    inline size_t resultSize(uint32_t kind, uint32_t count) { return kind == ClosestHit ? count * sizeof(float) : (count + 7) / 8; }
+
+    struct Header {
+        char magic[4];
+        uint32_t id;
+        uint32_t kind;
+        uint32_t count;
+    };
+
+    inline void writeHeader(uint8_t* out, const char* magic, uint32_t id, uint32_t kind, uint32_t count) {
+        Header header;
+        std::memcpy(header.magic, magic, 4);
+        header.id = id;
+        header.kind = kind;
+        header.count = count;
+        std::memcpy(out, &header, HeaderSize);
+    }
+
+    // Batches at least this big are traced in RayOrder, on scenes whose BVH
+    // is too big to stay in cache; otherwise sorting costs more than the
+    // cache misses it saves.
+    const uint32_t MinSorted = 2048;
+    const size_t MinSortedCircles = 50000;
+
+    // Buffers a server keeps between batches so sorting allocates nothing
+    // once they have grown.
+    struct Scratch {
+        RayOrder order;
+        // One byte per Visible query, packed into bits afterwards.
+        std::vector<uint8_t> visible;
+    };
+
+    inline void fetchRay(uint32_t kind, const uint8_t* records, uint32_t i, Vec2& origin, Vec2& dir) {
+        float r[4];
+        std::memcpy(r, records + i * recordSize(kind), sizeof(r));
+        origin = Vec2(r[0], r[1]);
+        dir = kind == ClosestHit ? Vec2(r[2], r[3]) : Vec2(r[2], r[3]) - origin;
+    }
+
+    // Answers count records into results, in parallel chunks. Given
+    // scratch, big batches on big scenes are traced sorted by origin and
+    // direction; the results are the same. Unsorted chunks are a multiple of eight
+    // queries so visibility bits never share a byte across threads.
+    inline void answer(ThreadPool& pool, const Scene& scene, uint32_t kind, uint32_t count,
+        const uint8_t* records, uint8_t* results, Scratch* scratch = nullptr) {
+        const int chunk = 1024;
+        int chunks = static_cast<int>((count + chunk - 1) / chunk);
+        bool sorted = scratch && count >= MinSorted && scene.bvh.getPrimitives().size() >= MinSortedCircles;
+        if (sorted) {
+            scratch->order.sort(count, [&](uint32_t i, Vec2& origin, Vec2& dir) { fetchRay(kind, records, i, origin, dir); });
+            if (kind == Visible) scratch->visible.resize(count);
+        }
+        pool.parallelFor(chunks, [&](int c) {
+            uint32_t begin = static_cast<uint32_t>(c) * chunk;
+            uint32_t end = begin + chunk < count ? begin + chunk : count;
+            if (kind == ClosestHit) {
+                for (uint32_t i = begin; i < end; ++i) {
+                    uint32_t q = sorted ? scratch->order[i] : i;
+                    float r[5];
+                    std::memcpy(r, records + q * 5 * sizeof(float), sizeof(r));
+                    float t;
+                    if (!scene.intersect(Vec2(r[0], r[1]), Vec2(r[2], r[3]), r[4], t)) t = -1.0f;
+                    std::memcpy(results + q * sizeof(float), &t, sizeof(float));
+                }
+            }
+            else {
+                if (!sorted) std::memset(results + begin / 8, 0, (end - begin + 7) / 8);
+                for (uint32_t i = begin; i < end; ++i) {
+                    uint32_t q = sorted ? scratch->order[i] : i;
+                    Vec2 from, dir;
+                    fetchRay(kind, records, q, from, dir);
+                    // Hits closer than the end point block the segment.
+                    float t;
+                    bool visible = !scene.intersect(from, dir, 0.9999f, t);
+                    if (sorted) scratch->visible[q] = visible;
+                    else if (visible) results[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+                }
+            }
+        });
+        if (sorted && kind == Visible) {
+            pool.parallelFor(chunks, [&](int c) {
+                uint32_t begin = static_cast<uint32_t>(c) * chunk;
+                uint32_t end = begin + chunk < count ? begin + chunk : count;
+                std::memset(results + begin / 8, 0, (end - begin + 7) / 8);
+                for (uint32_t i = begin; i < end; ++i) {
+                    if (scratch->visible[i]) results[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+                }
+            });
+        }
+    }
+}
+
+// Keeps one scene's BVH warm and answers queries from any number of local
+// clients. A single thread waits on all connections and reads whatever
+// requests have arrived; each request is then answered by the whole pool,
+// so a big batch from one client finishes before the next is started.
+// Responses queue per connection and go out as its socket takes them, so a
+// client that keeps requests in flight without reading stalls only itself:
+// once its unsent responses pass MaxPendingOutput, its requests are left
+// unread until it catches up. Malformed requests close the connection.
+class RayQueryServer {
+public:
+    static const int MaxConnections = 32;
+    static const size_t MaxPendingOutput = 4u << 20;
+
+    RayQueryServer(const Scene& scene, ThreadPool& pool) : scene(scene), pool(pool) {}
+
+    bool listen(const char* address, int port) {
+        listener = TcpSocket::listen(address, port);
+        return listener.valid();
+    }
+
+    // Serves whatever is ready within timeoutMs.
+    void poll(int timeoutMs) {
+        TcpSocket* sockets[MaxConnections + 1];
+        bool watchRead[MaxConnections + 1];
+        bool watchWrite[MaxConnections + 1];
+        bool readable[MaxConnections + 1];
+        bool writable[MaxConnections + 1];
+        int count = 0;
+        watchRead[count] = true;
+        watchWrite[count] = false;
+        sockets[count++] = &listener;
+        for (Connection& connection : connections) {
+            watchRead[count] = connection.pending() < MaxPendingOutput;
+            watchWrite[count] = connection.pending() > 0;
+            sockets[count++] = &connection.socket;
+        }
+        if (TcpSocket::waitAny(sockets, count, timeoutMs, watchRead, watchWrite, readable, writable) == 0) return;
+
+        for (size_t i = 0; i < connections.size(); ++i) {
+            Connection& connection = connections[i];
+            if (writable[i + 1]) flush(connection);
+            if (readable[i + 1] && connection.socket.valid()) receive(connection);
+            // Requests left unanswered while the output was full.
+            else if (writable[i + 1] && connection.socket.valid()) answerBuffered(connection);
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(),
+            [](const Connection& c) { return !c.socket.valid(); }), connections.end());
+
+        if (readable[0]) {
+            TcpSocket client = listener.accept(0);
+            if (client.valid() && connections.size() < MaxConnections) {
+                connections.emplace_back();
+                connections.back().socket = std::move(client);
+            }
+        }
+    }
+
+    int connectionCount() const { return static_cast<int>(connections.size()); }
+    uint64_t queriesAnswered() const { return answered; }
+
+private:
+    struct Connection {
+        TcpSocket socket;
+        std::vector<uint8_t> input;
+        // Responses; the first sent bytes have gone out.
+        std::vector<uint8_t> output;
+        size_t sent = 0;
+
+        size_t pending() const { return output.size() - sent; }
+    };
+
+    void receive(Connection& connection) {
+        uint8_t buffer[64 * 1024];
+        int received = connection.socket.receiveSome(buffer, sizeof(buffer), 0);
+        if (received < 0) {
+            connection.socket.close();
+            return;
+        }
+        connection.input.insert(connection.input.end(), buffer, buffer + received);
+        answerBuffered(connection);
+    }
+
+    // Answers the complete requests in input, while the unsent output is
+    // under MaxPendingOutput, and sends what the socket takes.
+    void answerBuffered(Connection& connection) {
+        size_t offset = 0;
+        while (connection.input.size() - offset >= RayQuery::HeaderSize) {
+            // Requests left over here are answered once the socket is
+            // writable again.
+            if (connection.pending() >= MaxPendingOutput) flush(connection);
+            if (!connection.socket.valid() || connection.pending() >= MaxPendingOutput) break;
+            RayQuery::Header header;
+            std::memcpy(&header, &connection.input[offset], RayQuery::HeaderSize);
+            if (std::memcmp(header.magic, "SRTQ", 4) != 0 || header.kind > RayQuery::Visible
+                || header.count > RayQuery::MaxCount) {
+                connection.socket.close();
+                return;
+            }
+            size_t size = RayQuery::HeaderSize + header.count * RayQuery::recordSize(header.kind);
+            if (connection.input.size() - offset < size) break;
+
+            if (connection.sent > 0) {
+                connection.output.erase(connection.output.begin(), connection.output.begin() + connection.sent);
+                connection.sent = 0;
+            }
+            size_t at = connection.output.size();
+            connection.output.resize(at + RayQuery::HeaderSize + RayQuery::resultSize(header.kind, header.count));
+            RayQuery::writeHeader(&connection.output[at], "SRTR", header.id, header.kind, header.count);
+            RayQuery::answer(pool, scene, header.kind, header.count,
+                &connection.input[offset + RayQuery::HeaderSize], &connection.output[at + RayQuery::HeaderSize], &scratch);
+            answered += header.count;
+            offset += size;
+        }
+        connection.input.erase(connection.input.begin(), connection.input.begin() + offset);
+        if (connection.socket.valid()) flush(connection);
+    }
+
+    void flush(Connection& connection) {
+        while (connection.pending() > 0) {
+            int sent = connection.socket.sendSome(&connection.output[connection.sent], connection.pending());
+            if (sent < 0) {
+                connection.socket.close();
+                return;
+            }
+            if (sent == 0) return;
+            connection.sent += static_cast<size_t>(sent);
+        }
+        connection.output.clear();
+        connection.sent = 0;
+    }
+
+    const Scene& scene;
+    ThreadPool& pool;
+    TcpSocket listener;
+    std::vector<Connection> connections;
+    RayQuery::Scratch scratch;
+    uint64_t answered = 0;
+};
+
+// Client side: sends requests and reads responses in order.
+class RayQueryClient {
+public:
+    bool connect(const char* host, int port) {
+        socket = TcpSocket::connect(host, port);
+        return socket.valid();
+    }
+
+    // records holds count records of the kind's layout.
+    bool send(uint32_t id, uint32_t kind, const float* records, uint32_t count) {
+        uint8_t header[RayQuery::HeaderSize];
+        RayQuery::writeHeader(header, "SRTQ", id, kind, count);
+        return socket.sendAll(header, sizeof(header)) && socket.sendAll(records, count * RayQuery::recordSize(kind));
+    }
+
+    // Reads the next response into results; id is the request it answers.
+    bool receive(uint32_t& id, std::vector<uint8_t>& results) {
+        RayQuery::Header header;
+        if (!socket.receiveAll(&header, RayQuery::HeaderSize) || std::memcmp(header.magic, "SRTR", 4) != 0) return false;
+        id = header.id;
+        results.resize(RayQuery::resultSize(header.kind, header.count));
+        return results.empty() || socket.receiveAll(results.data(), results.size());
+    }
+
+private:
+    TcpSocket socket;
+};
+
+// The same queries for processes on the same machine, through a shared
+// memory region instead of a socket:
+//
+//     Header                                       one cache line per counter
+//     circles       the scene, circleCount Circle records
+//     slots         slots x { SlotHeader, records, results }
+//
+// One producer fills the records of the next free slot in place and bumps
+// submitted; the server answers slots in order, writing results in place,
+// and bumps completed. Batch n lives in slot n % slots, and its results stay
+// valid until batch n + slots is submitted. Both counters only grow
+// (wrapping at 2^32) and each has a single writer, so the ring needs no locks,
+// only release stores and acquire loads. Waiting spins briefly, then yields,
+// then sleeps.
+namespace SharedQueries {
+    static_assert(ATOMIC_INT_LOCK_FREE == 2, "counters shared between processes must be lock-free");
+
+    const size_t Align = 64;
+    // More queries a slot than any client would ask for, and few enough that
+    // slotSize() cannot overflow.
+    const uint32_t MaxSlotQueries = 1u << 24;
+
+    struct Header {
+        char magic[4];
+        uint32_t slots;
+        uint32_t slotQueries;
+        uint32_t circleCount;
+        uint64_t circlesOffset;
+        uint64_t slotsOffset;
+        uint64_t slotSize;
+        alignas(64) std::atomic<uint32_t> submitted;
+        alignas(64) std::atomic<uint32_t> completed;
+    };
+
+    struct SlotHeader {
+        uint32_t kind;
+        uint32_t count;
+        uint32_t rejected;
+    };
+
+    inline size_t roundUp(size_t size) { return (size + Align - 1) / Align * Align; }
+    inline size_t recordsOffset() { return roundUp(sizeof(SlotHeader)); }
+    inline size_t resultsOffset(uint32_t slotQueries) { return recordsOffset() + roundUp(slotQueries * RayQuery::recordSize(RayQuery::ClosestHit)); }
+    inline size_t slotSize(uint32_t slotQueries) { return resultsOffset(slotQueries) + roundUp(RayQuery::resultSize(RayQuery::ClosestHit, slotQueries)); }
+
+    // The slot geometry, kept apart from the header: the region is writable
+    // by every process that opens it, so each side reads the header once.
+    struct Ring {
+        uint8_t* base;
+        uint32_t slots;
+        uint32_t slotQueries;
+        size_t slotSize;
+
+        uint8_t* slot(uint32_t ticket) const { return base + (ticket % slots) * slotSize; }
+    };
+
+    inline bool reached(const std::atomic<uint32_t>& counter, uint32_t target) {
+        return static_cast<int32_t>(counter.load(std::memory_order_acquire) - target) >= 0;
+    }
+
+    // Waits up to timeoutMs for counter to reach target.
+    inline bool waitFor(const std::atomic<uint32_t>& counter, uint32_t target, int timeoutMs) {
+        for (int spin = 0; spin < 256; ++spin) {
+            if (reached(counter, target)) return true;
+        }
+        auto start = std::chrono::steady_clock::now();
+        auto deadline = start + std::chrono::milliseconds(timeoutMs);
+        while (!reached(counter, target)) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) return false;
+            if (now - start < std::chrono::microseconds(200)) std::this_thread::yield();
+            else std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        return true;
+    }
+}
+
+// Creates the region, copies the scene's circles into it and answers batches
+// as they are submitted, each with the whole pool.
+class SharedQueryServer {
+public:
+    SharedQueryServer(const Scene& scene, ThreadPool& pool) : scene(scene), pool(pool) {}
+
+    bool create(const char* name, uint32_t slots = 8, uint32_t slotQueries = 1u << 16) {
+        using namespace SharedQueries;
+        size_t circlesOffset = roundUp(sizeof(Header));
+        size_t slotsOffset = circlesOffset + roundUp(scene.circles.size() * sizeof(Circle));
+        region = SharedMemory::create(name, slotsOffset + slots * slotSize(slotQueries));
+        if (!region.valid()) return false;
+
+        uint8_t* base = static_cast<uint8_t*>(region.get());
+        if (!scene.circles.empty()) std::memcpy(base + circlesOffset, scene.circles.data(), scene.circles.size() * sizeof(Circle));
+        header = reinterpret_cast<Header*>(base);
+        header->slots = slots;
+        header->slotQueries = slotQueries;
+        header->circleCount = static_cast<uint32_t>(scene.circles.size());
+        header->circlesOffset = circlesOffset;
+        header->slotsOffset = slotsOffset;
+        header->slotSize = slotSize(slotQueries);
+        header->submitted.store(0, std::memory_order_relaxed);
+        header->completed.store(0, std::memory_order_relaxed);
+        // Clients check the magic last, so they never see a half-written header.
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(header->magic, "SRTS", 4);
+        // Clients can write to the header; the server goes by its own copy.
+        ring = Ring{ base + slotsOffset, slots, slotQueries, slotSize(slotQueries) };
+        served = 0;
+        return true;
+    }
+
+    // Answers the batches submitted so far, at most a ring's worth, waiting
+    // up to timeoutMs for the first one; returns how many were answered.
+    int poll(int timeoutMs) {
+        using namespace SharedQueries;
+        if (!waitFor(header->submitted, served + 1, timeoutMs)) return 0;
+        int batches = 0;
+        while (batches < static_cast<int>(ring.slots) && reached(header->submitted, served + 1)) {
+            uint8_t* slot = ring.slot(served);
+            SlotHeader* batch = reinterpret_cast<SlotHeader*>(slot);
+            // Read once: the client may still be writing them.
+            uint32_t kind = static_cast<volatile uint32_t&>(batch->kind);
+            uint32_t count = static_cast<volatile uint32_t&>(batch->count);
+            bool rejected = kind > RayQuery::Visible || count > ring.slotQueries;
+            batch->rejected = rejected;
+            if (!rejected) {
+                RayQuery::answer(pool, scene, kind, count, slot + recordsOffset(), slot + resultsOffset(ring.slotQueries), &scratch);
+                answered += count;
+            }
+            header->completed.store(++served, std::memory_order_release);
+            ++batches;
+        }
+        return batches;
+    }
+
+    uint64_t queriesAnswered() const { return answered; }
+
+private:
+    const Scene& scene;
+    ThreadPool& pool;
+    SharedMemory region;
+    SharedQueries::Header* header = nullptr;
+    SharedQueries::Ring ring = {};
+    RayQuery::Scratch scratch;
+    uint32_t served = 0;
+    uint64_t answered = 0;
+};
+
+// Producer side. Records are written straight into the ring and results
+// read from it, so nothing is copied on either side. A region supports one
+// producer at a time.
+class SharedQueryClient {
+public:
+    // False if there is no region of that name or its header does not
+    // describe circles and slots that fit in it.
+    bool open(const char* name) {
+        using namespace SharedQueries;
+        region = SharedMemory::open(name);
+        header = static_cast<Header*>(region.get());
+        if (!region.valid() || region.getSize() < sizeof(Header) || std::memcmp(header->magic, "SRTS", 4) != 0) return fail();
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        // Read once and checked against the region before any slot is used.
+        uint32_t slots = static_cast<volatile uint32_t&>(header->slots);
+        uint32_t slotQueries = static_cast<volatile uint32_t&>(header->slotQueries);
+        uint32_t circles = static_cast<volatile uint32_t&>(header->circleCount);
+        uint64_t circlesAt = static_cast<volatile uint64_t&>(header->circlesOffset);
+        uint64_t slotsAt = static_cast<volatile uint64_t&>(header->slotsOffset);
+        uint64_t size = static_cast<volatile uint64_t&>(header->slotSize);
+        uint64_t regionSize = region.getSize();
+        if (slots == 0 || slotQueries == 0 || slotQueries > MaxSlotQueries || size != slotSize(slotQueries)
+            || circlesAt < sizeof(Header) || circlesAt % alignof(Circle) != 0 || circlesAt > regionSize
+            || circles > (regionSize - circlesAt) / sizeof(Circle)
+            || slotsAt < sizeof(Header) || slotsAt % Align != 0 || slotsAt > regionSize
+            || slots > (regionSize - slotsAt) / size) return fail();
+        ring = Ring{ base() + slotsAt, slots, slotQueries, static_cast<size_t>(size) };
+        circleData = reinterpret_cast<const Circle*>(base() + circlesAt);
+        circleTotal = circles;
+        next = header->submitted.load(std::memory_order_acquire);
+        return true;
+    }
+
+    uint32_t capacity() const { return ring.slotQueries; }
+    uint32_t slotCount() const { return ring.slots; }
+    uint32_t circleCount() const { return circleTotal; }
+    const Circle* circles() const { return circleData; }
+
+    // Where to write the next batch's records, in the kind's layout, once
+    // its slot is free; null if it is not within timeoutMs.
+    float* nextRecords(int timeoutMs) {
+        if (!SharedQueries::waitFor(header->completed, next - ring.slots + 1, timeoutMs)) return nullptr;
+        return reinterpret_cast<float*>(ring.slot(next) + SharedQueries::recordsOffset());
+    }
+
+    // Publishes the records written through nextRecords() as a batch of
+    // count queries and returns its ticket.
+    uint32_t submit(uint32_t kind, uint32_t count) {
+        SharedQueries::SlotHeader* batch = reinterpret_cast<SharedQueries::SlotHeader*>(ring.slot(next));
+        batch->kind = kind;
+        batch->count = count;
+        header->submitted.store(next + 1, std::memory_order_release);
+        return next++;
+    }
+
+    // The ticket's results, laid out as in the socket response; null if
+    // they are not ready within timeoutMs or the batch was rejected.
+    const uint8_t* results(uint32_t ticket, int timeoutMs) const {
+        if (!SharedQueries::waitFor(header->completed, ticket + 1, timeoutMs)) return nullptr;
+        const uint8_t* s = ring.slot(ticket);
+        if (reinterpret_cast<const SharedQueries::SlotHeader*>(s)->rejected) return nullptr;
+        return s + SharedQueries::resultsOffset(ring.slotQueries);
+    }
+
+private:
+    uint8_t* base() const { return static_cast<uint8_t*>(region.get()); }
+
+    bool fail() {
+        region.close();
+        header = nullptr;
+        return false;
+    }
+
+    SharedMemory region;
+    SharedQueries::Header* header = nullptr;
+    SharedQueries::Ring ring = {};
+    const Circle* circleData = nullptr;
+    uint32_t circleTotal = 0;
+    uint32_t next = 0;
+};
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "Geometry.h"
+
+// Reorders a batch of rays so that rays starting close together and heading
+// the same way are traced one after another. Each ray's key is the Morton
+// code of its origin's cell on a grid over the batch's origins, with the
+// octant of its direction below it; keys are radix sorted together with the
+// rays' indices. Rays that follow each other then visit the same BVH nodes
+// and occupancy cells while they are still in cache.
+class RayOrder {
+public:
+    // Cells along each side of the origin grid.
+    static const int CellBits = 10;
+
+    // ray(i, origin, dir) fetches ray i; it is called twice per ray.
+    template <typename GetRay>
+    void sort(uint32_t count, GetRay&& ray) {
+        entries.resize(count);
+        spare.resize(count);
+        Aabb bounds;
+        for (uint32_t i = 0; i < count; ++i) {
+            Vec2 origin, dir;
+            ray(i, origin, dir);
+            bounds.grow(Aabb(origin, origin));
+        }
+        const float cells = static_cast<float>(1 << CellBits);
+        Vec2 extent = bounds.extent();
+        Vec2 scale(cells / std::max(extent.x, 1e-6f), cells / std::max(extent.y, 1e-6f));
+        for (uint32_t i = 0; i < count; ++i) {
+            Vec2 origin, dir;
+            ray(i, origin, dir);
+            uint32_t x = cell((origin.x - bounds.min.x) * scale.x);
+            uint32_t y = cell((origin.y - bounds.min.y) * scale.y);
+            uint64_t key = static_cast<uint64_t>(mortonCode(x, y)) << 3 | octant(dir);
+            entries[i] = key << 32 | i;
+        }
+        radixSort();
+    }
+
+    // Index of the ray traced at position i.
+    uint32_t operator[](uint32_t i) const { return static_cast<uint32_t>(entries[i]); }
+
+private:
+    static const int KeyBits = 2 * CellBits + 3;
+    static const int Passes = (KeyBits + 7) / 8;
+
+    static uint32_t cell(float v) {
+        return static_cast<uint32_t>(std::min(std::max(v, 0.0f), static_cast<float>((1 << CellBits) - 1)));
+    }
+
+    // Octants numbered counter-clockwise from +x, so neighbouring keys
+    // point in neighbouring directions.
+    static uint32_t octant(const Vec2& d) {
+        bool steep = std::abs(d.y) > std::abs(d.x);
+        if (d.y >= 0) return d.x >= 0 ? steep : 3 - steep;
+        return d.x < 0 ? 4 + steep : 7 - steep;
+    }
+
+    // LSD radix sort of entries by key, a byte per pass; passes where every
+    // key has the same byte are skipped.
+    void radixSort() {
+        uint32_t counts[Passes][256] = {};
+        for (uint64_t entry : entries) {
+            for (int p = 0; p < Passes; ++p) ++counts[p][(entry >> (32 + 8 * p)) & 0xff];
+        }
+        for (int p = 0; p < Passes; ++p) {
+            int shift = 32 + 8 * p;
+            if (entries.empty() || counts[p][(entries[0] >> shift) & 0xff] == entries.size()) continue;
+            uint32_t offset = 0;
+            for (uint32_t& bucket : counts[p]) {
+                uint32_t size = bucket;
+                bucket = offset;
+                offset += size;
+            }
+            for (uint64_t entry : entries) spare[counts[p][(entry >> shift) & 0xff]++] = entry;
+            entries.swap(spare);
+        }
+    }
+
+    // Key in the high half, ray index in the low half.
+    std::vector<uint64_t> entries;
+    std::vector<uint64_t> spare;
+};
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "FrameStream.h"
+#include "Net.h"
+
+// Splits an offline render of one or more frames into tiles and spreads
+// them over worker processes, which connect to the coordinator over TCP.
+// Every message starts with a 16-byte header, a magic and three u32 fields
+// in memory order (little-endian on every platform this builds for):
+//
+//     worker:      "SRTW" circles, lights, 0          hello, once
+//     coordinator: "SRTJ" width, height, tile size    the job, in reply
+//     coordinator: "SRTT" task, 0, 0                  render this tile
+//     worker:      "SRTP" task, bytes, 0              then the tile's pixels
+//     coordinator: "SRTD" 0, 0, 0                     all done
+//
+// Task n is tile n % tilesPerFrame of frame n / tilesPerFrame, tiles
+// numbered row by row. Tile pixels are one FrameStream block encoding. The
+// hello carries the worker's scene size so that a worker started with
+// other scene options is turned away rather than rendering the wrong
+// scene.
+namespace RenderFarm {
+    const size_t HeaderSize = 16;
+    // Tiles handed to a worker ahead of the one it is rendering, so it
+    // never waits for the coordinator between tiles.
+    const int Prefetch = 2;
+    // The widest or tallest image, and the largest tile, either end accepts.
+    const int MaxSize = 16384;
+
+    struct Header {
+        char magic[4];
+        uint32_t a, b, c;
+    };
+
+    inline bool sendHeader(TcpSocket& socket, const char* magic, uint32_t a, uint32_t b, uint32_t c) {
+        Header header;
+        std::memcpy(header.magic, magic, 4);
+        header.a = a;
+        header.b = b;
+        header.c = c;
+        return socket.sendAll(&header, HeaderSize);
+    }
+
+    struct Job {
+        int width = 0;
+        int height = 0;
+        int tileSize = 128;
+
+        bool valid() const {
+            return width > 0 && height > 0 && tileSize > 0 && width <= MaxSize && height <= MaxSize && tileSize <= MaxSize;
+        }
+
+        int tilesX() const { return (width + tileSize - 1) / tileSize; }
+        int tilesPerFrame() const { return tilesX() * ((height + tileSize - 1) / tileSize); }
+
+        void tileRect(uint32_t task, int& frame, int& x, int& y, int& w, int& h) const {
+            int tile = static_cast<int>(task % tilesPerFrame());
+            frame = static_cast<int>(task / tilesPerFrame());
+            x = tile % tilesX() * tileSize;
+            y = tile / tilesX() * tileSize;
+            w = std::min(tileSize, width - x);
+            h = std::min(tileSize, height - y);
+        }
+    };
+}
+
+// Hands out tiles and composites the results. Work starts once the expected
+// number of workers is connected: each gets a contiguous run of tasks, so
+// neighbouring tiles of a frame tend to land on the same worker. A worker
+// that runs out steals the back half of the longest remaining run, which
+// also puts workers that join late to use. Tasks of a worker that
+// disconnects go back to the others.
+class RenderCoordinator {
+public:
+    // select() watches the listener and every worker; Windows' fd_set
+    // holds FD_SETSIZE (64) sockets and drops the rest.
+    static const int MaxWorkers = FD_SETSIZE - 1 < 64 ? FD_SETSIZE - 1 : 64;
+
+    // Called with each finished frame's row-major pixels.
+    typedef std::function<void(int frame, const std::vector<uint32_t>& pixels)> FrameDone;
+
+    RenderCoordinator(const RenderFarm::Job& job, int frames, uint32_t circles, uint32_t lights)
+        : job(job), frames(frames), circles(circles), lights(lights) {}
+
+    bool listen(const char* address, int port) {
+        listener = TcpSocket::listen(address, port);
+        return listener.valid();
+    }
+
+    // Runs the job to the end; waits as long as it takes for workers.
+    // onStart is called once they are all there and work is handed out.
+    void run(int expectedWorkers, const FrameDone& frameDone, const std::function<void()>& onStart) {
+        uint32_t tasks = static_cast<uint32_t>(frames) * job.tilesPerFrame();
+        images.assign(frames, std::vector<uint32_t>());
+        remaining.assign(frames, job.tilesPerFrame());
+        int framesLeft = frames;
+        bool started = false;
+
+        while (framesLeft > 0) {
+            TcpSocket* sockets[MaxWorkers + 1];
+            bool readable[MaxWorkers + 1];
+            int count = 0;
+            sockets[count++] = &listener;
+            for (Worker& worker : workers) sockets[count++] = &worker.socket;
+            if (TcpSocket::waitAnyReadable(sockets, count, 1000, readable) == 0) continue;
+
+            for (size_t i = 0; i < workers.size(); ++i) {
+                if (readable[i + 1]) framesLeft -= receive(workers[i], frameDone);
+            }
+            for (Worker& worker : workers) {
+                if (worker.socket.valid()) continue;
+                orphans.insert(orphans.end(), worker.outstanding.begin(), worker.outstanding.end());
+                orphans.insert(orphans.end(), worker.queue.begin(), worker.queue.end());
+            }
+            workers.erase(std::remove_if(workers.begin(), workers.end(),
+                [](const Worker& w) { return !w.socket.valid(); }), workers.end());
+
+            if (readable[0]) {
+                TcpSocket client = listener.accept(0);
+                if (client.valid() && workers.size() < MaxWorkers) {
+                    workers.emplace_back();
+                    workers.back().socket = std::move(client);
+                }
+            }
+
+            int ready = 0;
+            for (const Worker& worker : workers) ready += worker.ready;
+            if (!started && ready >= expectedWorkers) {
+                // Contiguous runs, one per worker, in connection order.
+                uint32_t next = 0;
+                int share = 0;
+                for (Worker& worker : workers) {
+                    if (!worker.ready) continue;
+                    uint32_t end = static_cast<uint32_t>(static_cast<uint64_t>(tasks) * ++share / ready);
+                    for (; next < end; ++next) worker.queue.push_back(next);
+                }
+                started = true;
+                onStart();
+            }
+            if (started) {
+                for (Worker& worker : workers) {
+                    if (worker.ready) feed(worker);
+                }
+            }
+        }
+        for (Worker& worker : workers) RenderFarm::sendHeader(worker.socket, "SRTD", 0, 0, 0);
+    }
+
+    struct WorkerStats {
+        int rendered;
+        int stolen;
+    };
+
+    // One entry per worker that has connected, in connection order.
+    const std::vector<WorkerStats>& getStats() const { return stats; }
+
+private:
+    struct Worker {
+        TcpSocket socket;
+        std::vector<uint8_t> input;
+        std::deque<uint32_t> queue;
+        std::vector<uint32_t> outstanding;
+        bool ready = false;
+        int id = -1;
+    };
+
+    // Reads what a worker sent; returns how many frames it completed.
+    int receive(Worker& worker, const FrameDone& frameDone) {
+        uint8_t buffer[64 * 1024];
+        int received = worker.socket.receiveSome(buffer, sizeof(buffer), 0);
+        if (received < 0) {
+            worker.socket.close();
+            return 0;
+        }
+        worker.input.insert(worker.input.end(), buffer, buffer + received);
+
+        int completed = 0;
+        size_t offset = 0;
+        while (worker.input.size() - offset >= RenderFarm::HeaderSize) {
+            RenderFarm::Header header;
+            std::memcpy(&header, &worker.input[offset], RenderFarm::HeaderSize);
+            if (!worker.ready && std::memcmp(header.magic, "SRTW", 4) == 0) {
+                offset += RenderFarm::HeaderSize;
+                if (header.a != circles || header.b != lights) {
+                    worker.socket.close();
+                    return completed;
+                }
+                RenderFarm::sendHeader(worker.socket, "SRTJ", job.width, job.height, job.tileSize);
+                worker.ready = true;
+                worker.id = static_cast<int>(stats.size());
+                stats.push_back(WorkerStats{ 0, 0 });
+                continue;
+            }
+            if (!worker.ready || std::memcmp(header.magic, "SRTP", 4) != 0) {
+                worker.socket.close();
+                return completed;
+            }
+            // A tile's payload is never bigger than its worst-case encoding;
+            // anything claiming more is not buffered.
+            if (header.b > BlockCodec::maxEncodedSize(job.tileSize, job.tileSize)) {
+                worker.socket.close();
+                return completed;
+            }
+            if (worker.input.size() - offset < RenderFarm::HeaderSize + header.b) break;
+
+            auto task = std::find(worker.outstanding.begin(), worker.outstanding.end(), header.a);
+            if (task == worker.outstanding.end()) {
+                worker.socket.close();
+                return completed;
+            }
+            worker.outstanding.erase(task);
+            int frame, x, y, w, h;
+            job.tileRect(header.a, frame, x, y, w, h);
+            std::vector<uint32_t>& image = images[frame];
+            if (image.empty()) image.assign(static_cast<size_t>(job.width) * job.height, 0);
+            if (!BlockCodec::decode(&worker.input[offset + RenderFarm::HeaderSize], header.b,
+                    &image[static_cast<size_t>(y) * job.width + x], job.width, w, h)) {
+                worker.socket.close();
+                orphans.push_back(header.a);
+                return completed;
+            }
+            offset += RenderFarm::HeaderSize + header.b;
+            ++stats[worker.id].rendered;
+            if (--remaining[frame] == 0) {
+                frameDone(frame, image);
+                std::vector<uint32_t>().swap(image);
+                ++completed;
+            }
+        }
+        worker.input.erase(worker.input.begin(), worker.input.begin() + offset);
+        return completed;
+    }
+
+    // Keeps Prefetch tasks in flight to worker: from its own run, then from
+    // disconnected workers' tasks, then stolen.
+    void feed(Worker& worker) {
+        while (static_cast<int>(worker.outstanding.size()) < RenderFarm::Prefetch) {
+            uint32_t task;
+            if (!worker.queue.empty()) {
+                task = worker.queue.front();
+                worker.queue.pop_front();
+            }
+            else if (!orphans.empty()) {
+                task = orphans.front();
+                orphans.pop_front();
+            }
+            else if (steal(worker)) {
+                continue;
+            }
+            else {
+                return;
+            }
+            if (!RenderFarm::sendHeader(worker.socket, "SRTT", task, 0, 0)) {
+                orphans.push_back(task);
+                worker.socket.close();
+                return;
+            }
+            worker.outstanding.push_back(task);
+        }
+    }
+
+    bool steal(Worker& thief) {
+        Worker* victim = nullptr;
+        for (Worker& worker : workers) {
+            if (&worker != &thief && worker.socket.valid() && (!victim || worker.queue.size() > victim->queue.size())) victim = &worker;
+        }
+        if (!victim || victim->queue.empty()) return false;
+        size_t take = (victim->queue.size() + 1) / 2;
+        thief.queue.insert(thief.queue.end(), victim->queue.end() - take, victim->queue.end());
+        victim->queue.erase(victim->queue.end() - take, victim->queue.end());
+        stats[thief.id].stolen += static_cast<int>(take);
+        return true;
+    }
+
+    RenderFarm::Job job;
+    int frames;
+    uint32_t circles;
+    uint32_t lights;
+    TcpSocket listener;
+    std::vector<Worker> workers;
+    std::deque<uint32_t> orphans;
+    std::vector<std::vector<uint32_t>> images;
+    std::vector<int> remaining;
+    std::vector<WorkerStats> stats;
+};
+
+// Worker side: announces itself, then renders tasks until told it is done.
+class RenderWorker {
+public:
+    bool connect(const char* host, int port, uint32_t circles, uint32_t lights) {
+        socket = TcpSocket::connect(host, port);
+        RenderFarm::Header header;
+        if (!socket.valid() || !RenderFarm::sendHeader(socket, "SRTW", circles, lights, 0)
+            || !socket.receiveAll(&header, RenderFarm::HeaderSize) || std::memcmp(header.magic, "SRTJ", 4) != 0) {
+            socket.close();
+            return false;
+        }
+        job.width = static_cast<int>(header.a);
+        job.height = static_cast<int>(header.b);
+        job.tileSize = static_cast<int>(header.c);
+        if (header.a > static_cast<uint32_t>(RenderFarm::MaxSize) || header.b > static_cast<uint32_t>(RenderFarm::MaxSize)
+            || header.c > static_cast<uint32_t>(RenderFarm::MaxSize) || !job.valid()) {
+            socket.close();
+            return false;
+        }
+        return true;
+    }
+
+    const RenderFarm::Job& getJob() const { return job; }
+
+    // Waits for the next task; false when the job is done or the
+    // coordinator is gone.
+    bool nextTask(uint32_t& task) {
+        RenderFarm::Header header;
+        if (!socket.receiveAll(&header, RenderFarm::HeaderSize) || std::memcmp(header.magic, "SRTT", 4) != 0) return false;
+        task = header.a;
+        return true;
+    }
+
+    // pixels holds the task's tile, row-major and tightly packed.
+    bool sendTile(uint32_t task, const uint32_t* pixels, int w, int h) {
+        encoded.clear();
+        BlockCodec::encode(pixels, w, w, h, encoded);
+        return RenderFarm::sendHeader(socket, "SRTP", task, static_cast<uint32_t>(encoded.size()), 0)
+            && socket.sendAll(encoded.data(), encoded.size());
+    }
+
+private:
+    TcpSocket socket;
+    RenderFarm::Job job;
+    std::vector<uint8_t> encoded;
+};
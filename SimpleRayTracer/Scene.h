@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "AcceleratorCache.h"
+#include "Bvh.h"
+#include "Geometry.h"
+#include "OccupancyMap.h"
+#include "WideBvh.h"
+
+// Point light whose contribution is windowed to zero at radius, so nothing
+// outside the circle of influence needs to be traced or shaded.
+struct Light {
+    Vec2 position;
+    float radius;
+    float intensity;
+
+    Aabb influence() const { return Aabb::around(position, radius); }
+
+    float falloff(float distanceSquared) const {
+        float r2 = radius * radius;
+        if (distanceSquared >= r2) return 0.0f;
+        float window = 1.0f - distanceSquared / r2;
+        float scale = radius * 0.12f;
+        return intensity * window * window / (1.0f + distanceSquared / (scale * scale));
+    }
+};
+
+struct Scene {
+    std::vector<Circle> circles;
+    std::vector<Light> lights;
+    Bvh bvh;
+    // bvh collapsed to four children per node, for tracing rays.
+    WideBvh wideBvh;
+    OccupancyMap occupancy;
+
+    // With a cache, accelerators saved for the same circles and builder are
+    // loaded instead of built, and ones built are saved for the next run.
+    AcceleratorCache::Result rebuild(BvhBuilder builder = BvhBuilder::Lbvh, ThreadPool* pool = nullptr,
+        const AcceleratorCache* cache = nullptr) {
+        if (cache && cache->load(circles, builder, bvh, wideBvh, occupancy)) return AcceleratorCache::Result::Loaded;
+        bvh.build(circles, builder, pool);
+        wideBvh.build(bvh);
+        occupancy.build(circles);
+        bool saved = cache && cache->save(circles, builder, bvh, wideBvh, occupancy);
+        return saved ? AcceleratorCache::Result::Saved : AcceleratorCache::Result::NotSaved;
+    }
+
+    // WideBvh::intersect, with rays through empty space turned away by the
+    // occupancy map first.
+    bool intersect(const Vec2& origin, const Vec2& dir, float tMax, float& tHit,
+        const LodSettings* lod = nullptr) const {
+        return occupancy.mayHit(origin, dir, tMax, lod) && wideBvh.intersect(origin, dir, tMax, tHit, lod);
+    }
+
+    static Scene makeDefault() {
+        Scene scene;
+        scene.circles.push_back(Circle{ Vec2(400, 300), 50.0f });
+        scene.lights.push_back(Light{ Vec2(400, 300), 1000.0f, 0.45f });
+        scene.rebuild();
+        return scene;
+    }
+
+    // Uniformly scattered circles and small lights over a width x height
+    // area, for exercising the culling paths on large scenes.
+    static Scene makeRandom(int circleCount, int lightCount, float width, float height, uint32_t seed = 1,
+        BvhBuilder builder = BvhBuilder::Lbvh, ThreadPool* pool = nullptr) {
+        Scene scene = scatterRandom(circleCount, lightCount, width, height, seed);
+        scene.rebuild(builder, pool);
+        return scene;
+    }
+
+    // makeRandom's circles and lights, with the accelerators left to
+    // rebuild().
+    static Scene scatterRandom(int circleCount, int lightCount, float width, float height, uint32_t seed = 1) {
+        Scene scene;
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> xs(0.0f, width);
+        std::uniform_real_distribution<float> ys(0.0f, height);
+        std::uniform_real_distribution<float> radii(2.0f, 12.0f);
+        std::uniform_real_distribution<float> reach(60.0f, 250.0f);
+
+        scene.circles.reserve(circleCount);
+        for (int i = 0; i < circleCount; ++i) {
+            scene.circles.push_back(Circle{ Vec2(xs(rng), ys(rng)), radii(rng) });
+        }
+        scene.lights.push_back(Light{ Vec2(width * 0.5f, height * 0.5f), 400.0f, 0.45f });
+        for (int i = 1; i < lightCount; ++i) {
+            scene.lights.push_back(Light{ Vec2(xs(rng), ys(rng)), reach(rng), 0.3f });
+        }
+        return scene;
+    }
+
+    // circleCount small circles around 64 random centres, each one's
+    // distance from its centre falling off as a power law, so the dense
+    // cores build deep, lopsided trees. Lights as scatterRandom's.
+    static Scene scatterClustered(int circleCount, int lightCount, float width, float height, uint32_t seed = 1) {
+        Scene scene = scatterRandom(0, lightCount, width, height, seed);
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::uniform_real_distribution<float> radii(0.2f, 1.2f);
+        const int clusters = 64;
+        const float twoPi = 6.28318531f;
+        Vec2 centers[clusters];
+        for (Vec2& center : centers) center = Vec2(unit(rng) * width, unit(rng) * height);
+        float reach = std::min(width, height) * 0.5f;
+
+        scene.circles.reserve(circleCount);
+        for (int i = 0; i < circleCount; ++i) {
+            float angle = unit(rng) * twoPi;
+            float distance = reach * std::pow(unit(rng), 8.0f);
+            Vec2 offset(std::cos(angle) * distance, std::sin(angle) * distance);
+            scene.circles.push_back(Circle{ centers[i % clusters] + offset, radii(rng) });
+        }
+        return scene;
+    }
+};
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <SDL.h>
+#include <cmath>
+#include <vector>
+
+#include "Vec2.h"
+
+// SDL_RenderGeometry arrived in SDL 2.0.18; older versions fall back to
+// grouping draws by colour.
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#define SRT_SDL_GEOMETRY 1
+#endif
+
+// Collects a frame's lines, circle outlines and points for SDL's renderer
+// and submits them in as few calls as the SDL version allows. With
+// SDL_RenderGeometry every primitive becomes one-pixel-wide triangles with
+// per-vertex colour, so the whole batch is a single call. Without it there
+// is no call for disjoint segments, so primitives are grouped by colour:
+// the draw colour is set once per group, each circle is one
+// SDL_RenderDrawLines polyline and each group's points one
+// SDL_RenderDrawPoints call. Storage is kept between frames.
+class SdlBatch {
+public:
+    static const int CircleSegments = 32;
+
+    void clear() {
+#ifdef SRT_SDL_GEOMETRY
+        vertices.clear();
+        indices.clear();
+#else
+        for (Group& group : groups) {
+            group.lines.clear();
+            group.circles.clear();
+            group.points.clear();
+        }
+#endif
+    }
+
+    void addLine(const Vec2& a, const Vec2& b, SDL_Color color) {
+#ifdef SRT_SDL_GEOMETRY
+        Vec2 d = b - a;
+        float length = d.length();
+        if (length < 1e-3f) {
+            addPoint(a, color);
+            return;
+        }
+        Vec2 side = Vec2(-d.y, d.x) * (0.5f / length);
+        addQuad(a + side, a - side, b + side, b - side, color);
+#else
+        Group& group = groupFor(color);
+        group.lines.push_back(toPoint(a));
+        group.lines.push_back(toPoint(b));
+#endif
+    }
+
+    void addCircle(const Vec2& center, float radius, SDL_Color color) {
+        const Vec2* unit = unitCircle();
+#ifdef SRT_SDL_GEOMETRY
+        // A ring one pixel wide: an inner and an outer vertex per segment.
+        // Small circles take every second or fourth segment of the table.
+        int stride = radius < 4.0f ? 4 : radius < 12.0f ? 2 : 1;
+        int segments = CircleSegments / stride;
+        int base = static_cast<int>(vertices.size());
+        vertices.resize(base + 2 * segments);
+        SDL_Vertex* v = &vertices[base];
+        for (int i = 0; i < segments; ++i) {
+            v[2 * i] = vertex(center + unit[i * stride] * (radius - 0.5f), color);
+            v[2 * i + 1] = vertex(center + unit[i * stride] * (radius + 0.5f), color);
+        }
+        size_t first = indices.size();
+        indices.resize(first + 6 * segments);
+        int* index = &indices[first];
+        for (int i = 0; i < segments; ++i, index += 6) {
+            int inner = base + 2 * i;
+            int next = i + 1 < segments ? inner + 2 : base;
+            index[0] = inner;
+            index[1] = inner + 1;
+            index[2] = next;
+            index[3] = next;
+            index[4] = inner + 1;
+            index[5] = next + 1;
+        }
+#else
+        std::vector<SDL_Point>& circles = groupFor(color).circles;
+        for (int i = 0; i <= CircleSegments; ++i) circles.push_back(toPoint(center + unit[i % CircleSegments] * radius));
+#endif
+    }
+
+    void addPoint(const Vec2& p, SDL_Color color) {
+#ifdef SRT_SDL_GEOMETRY
+        addQuad(p + Vec2(-0.5f, -0.5f), p + Vec2(0.5f, -0.5f), p + Vec2(-0.5f, 0.5f), p + Vec2(0.5f, 0.5f), color);
+#else
+        groupFor(color).points.push_back(toPoint(p));
+#endif
+    }
+
+    // Draws everything collected since clear() and returns the number of
+    // draw calls it took.
+    int submit(SDL_Renderer* renderer) {
+        int calls = 0;
+#ifdef SRT_SDL_GEOMETRY
+        if (!indices.empty()) {
+            SDL_RenderGeometry(renderer, nullptr, vertices.data(), static_cast<int>(vertices.size()),
+                indices.data(), static_cast<int>(indices.size()));
+            ++calls;
+        }
+#else
+        for (const Group& group : groups) {
+            if (group.lines.empty() && group.circles.empty() && group.points.empty()) continue;
+            SDL_SetRenderDrawColor(renderer, group.color.r, group.color.g, group.color.b, group.color.a);
+            for (size_t i = 0; i + 1 < group.lines.size(); i += 2, ++calls) {
+                SDL_RenderDrawLine(renderer, group.lines[i].x, group.lines[i].y, group.lines[i + 1].x, group.lines[i + 1].y);
+            }
+            for (size_t i = 0; i < group.circles.size(); i += CircleSegments + 1, ++calls) {
+                SDL_RenderDrawLines(renderer, &group.circles[i], CircleSegments + 1);
+            }
+            if (!group.points.empty()) {
+                SDL_RenderDrawPoints(renderer, group.points.data(), static_cast<int>(group.points.size()));
+                ++calls;
+            }
+        }
+#endif
+        return calls;
+    }
+
+private:
+    static const Vec2* unitCircle() {
+        static Vec2 table[CircleSegments];
+        static bool initialized = false;
+        if (!initialized) {
+            const float twoPi = 6.28318531f;
+            for (int i = 0; i < CircleSegments; ++i) {
+                float angle = twoPi * i / CircleSegments;
+                table[i] = Vec2(std::cos(angle), std::sin(angle));
+            }
+            initialized = true;
+        }
+        return table;
+    }
+
+#ifdef SRT_SDL_GEOMETRY
+    static SDL_Vertex vertex(const Vec2& p, SDL_Color color) {
+        SDL_Vertex v;
+        v.position.x = p.x;
+        v.position.y = p.y;
+        v.color = color;
+        v.tex_coord.x = 0.0f;
+        v.tex_coord.y = 0.0f;
+        return v;
+    }
+
+    // Two triangles over the corners a, b (one end) and c, d (the other).
+    void addQuad(const Vec2& a, const Vec2& b, const Vec2& c, const Vec2& d, SDL_Color color) {
+        int base = static_cast<int>(vertices.size());
+        vertices.push_back(vertex(a, color));
+        vertices.push_back(vertex(b, color));
+        vertices.push_back(vertex(c, color));
+        vertices.push_back(vertex(d, color));
+        const int quad[6] = { base, base + 1, base + 2, base + 2, base + 1, base + 3 };
+        indices.insert(indices.end(), quad, quad + 6);
+    }
+
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+#else
+    struct Group {
+        SDL_Color color;
+        std::vector<SDL_Point> lines;
+        std::vector<SDL_Point> circles;
+        std::vector<SDL_Point> points;
+    };
+
+    static SDL_Point toPoint(const Vec2& p) {
+        SDL_Point point = { static_cast<int>(p.x), static_cast<int>(p.y) };
+        return point;
+    }
+
+    // A frame uses a handful of colours, so a linear search is enough.
+    Group& groupFor(SDL_Color color) {
+        for (Group& group : groups) {
+            if (group.color.r == color.r && group.color.g == color.g && group.color.b == color.b && group.color.a == color.a) {
+                return group;
+            }
+        }
+        groups.emplace_back();
+        groups.back().color = color;
+        return groups.back();
+    }
+
+    std::vector<Group> groups;
+#endif
+};
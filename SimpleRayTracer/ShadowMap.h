@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Vec2.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
+// Polar depth buffer around a point light: bin i holds the squared distance
+// from the light to the nearest occluder in that direction. Bins are indexed by the
+// "diamond angle" of the direction, a pseudo-angle in [0, 4) that is
+// monotonic in the true angle but needs only a division to compute, so a
+// per-pixel visibility query is a handful of arithmetic ops and table reads.
+class ShadowMap1D {
+public:
+    explicit ShadowMap1D(int resolution = 8192)
+        : storage(resolution + 2 * guardBins), binsPerUnit(resolution / 4.0f) {}
+
+    int resolution() const { return static_cast<int>(storage.size()) - 2 * guardBins; }
+
+    void clear(const Vec2& light, float maxDepth) {
+        lightPos = light;
+        farDepth = maxDepth * maxDepth;
+        std::fill(storage.begin(), storage.end(), farDepth);
+        measured.assign(resolution(), 1);
+        stride = 1;
+        phase = 0;
+        moved = false;
+    }
+
+    // Temporal alternative to clear() for a light that moved: the previous
+    // map is reprojected to the new position and only every stride-th bin
+    // (rotating each call) is emptied, so the following addCircle() calls
+    // touch 1/stride of the bins. resolveUpdate() then clamps each carried
+    // bin between its freshly written neighbours; bins the clamp changed are
+    // estimates and are not reprojected again. Falls back to clear() when
+    // stride does not divide the resolution or the depth range changed.
+    void beginUpdate(const Vec2& light, float maxDepth, int updateStride) {
+        int n = resolution();
+        float max2 = maxDepth * maxDepth;
+        if (updateStride <= 1 || n % updateStride != 0 || max2 != farDepth) {
+            clear(light, maxDepth);
+            return;
+        }
+
+        stride = updateStride;
+        phase = (phase + 1) % stride;
+        moved = light.x != lightPos.x || light.y != lightPos.y;
+        if (moved) reproject(light);
+        lightPos = light;
+        for (int bin = phase; bin < n; bin += stride) {
+            storage[guardBins + bin] = farDepth;
+            measured[bin] = 1;
+        }
+    }
+
+    void resolveUpdate() {
+        int n = resolution();
+        if (stride > 1 && moved) {
+            for (int bin = 0; bin < n; ++bin) {
+                int offset = (bin - phase + stride) % stride;
+                if (offset == 0) continue;
+                float a = depth(wrap(bin - offset, n));
+                float b = depth(wrap(bin - offset + stride, n));
+                float& d = storage[guardBins + bin];
+                float clamped = std::min(std::max(d, std::min(a, b)), std::max(a, b));
+                if (clamped != d) measured[bin] = 0;
+                d = clamped;
+            }
+        }
+        for (int g = 0; g < guardBins; ++g) {
+            storage[g] = storage[n + g];
+            storage[guardBins + n + g] = storage[guardBins + g];
+        }
+    }
+
+    // Writes the circle's silhouette into the bins between its two tangent
+    // directions, with the exact entry distance for each bin direction.
+    void addCircle(const Vec2& center, float radius) {
+        Vec2 toCenter = center - lightPos;
+        float d2 = toCenter.x * toCenter.x + toCenter.y * toCenter.y;
+        float r2 = radius * radius;
+        int n = resolution();
+
+        if (d2 <= r2) {
+            std::fill(storage.begin(), storage.end(), 0.0f);
+            return;
+        }
+
+        float d = std::sqrt(d2);
+        float sinHalf = radius / d;
+        float cosHalf = std::sqrt(1.0f - sinHalf * sinHalf);
+        Vec2 axis = toCenter * (1.0f / d);
+        Vec2 left(axis.x * cosHalf + axis.y * sinHalf, axis.y * cosHalf - axis.x * sinHalf);
+        Vec2 right(axis.x * cosHalf - axis.y * sinHalf, axis.y * cosHalf + axis.x * sinHalf);
+
+        int first = static_cast<int>(diamondAngle(left.x, left.y) * binsPerUnit);
+        int last = static_cast<int>(diamondAngle(right.x, right.y) * binsPerUnit);
+        if (last < first) last += n;
+        first += ((phase - first) % stride + stride) % stride;
+
+        for (int i = first; i <= last; i += stride) {
+            int bin = i < n ? i : i - n;
+            Vec2 dir = binDirection(bin);
+            float b = dir.x * toCenter.x + dir.y * toCenter.y;
+            float disc = b * b - (d2 - r2);
+            if (disc < 0) continue;
+            float t = b - std::sqrt(disc) + depthBias;
+            float t2 = t > 0 ? t * t : 0;
+            if (t2 < depth(bin)) setDepth(bin, t2);
+        }
+    }
+
+    // Fraction of the light, in [0, 1], that reaches each of count points
+    // start, start + step, start + 2 * step, ... (one row of pixels in world
+    // space). Three neighbouring bins are compared and blended
+    // (percentage-closer filtering) to soften the stair-stepping of the
+    // discrete angle. The angle, bin and filter weight are computed four
+    // points at a time.
+    void visibilityRow(const Vec2& start, const Vec2& step, int count, float* out) const {
+        Vec2 first = start - lightPos;
+        int x = 0;
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 scale = _mm_set1_ps(binsPerUnit);
+        const __m128 tiny = _mm_set1_ps(1e-20f);
+        const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+        __m128 dx = _mm_add_ps(_mm_set1_ps(first.x), _mm_mul_ps(lane, _mm_set1_ps(step.x)));
+        __m128 dy = _mm_add_ps(_mm_set1_ps(first.y), _mm_mul_ps(lane, _mm_set1_ps(step.y)));
+        const __m128 stepX4 = _mm_set1_ps(step.x * 4);
+        const __m128 stepY4 = _mm_set1_ps(step.y * 4);
+
+        for (; x + 4 <= count; x += 4, dx = _mm_add_ps(dx, stepX4), dy = _mm_add_ps(dy, stepY4)) {
+            __m128 adx = _mm_andnot_ps(signMask, dx);
+            __m128 ady = _mm_andnot_ps(signMask, dy);
+            __m128 sum = _mm_max_ps(_mm_add_ps(adx, ady), tiny);
+            __m128 dyNegative = _mm_cmplt_ps(dy, zero);
+            __m128 signsDiffer = _mm_xor_ps(_mm_cmplt_ps(dx, zero), dyNegative);
+            __m128 numerator = _mm_or_ps(_mm_and_ps(signsDiffer, adx), _mm_andnot_ps(signsDiffer, ady));
+            __m128 quadrant = _mm_add_ps(_mm_and_ps(dyNegative, _mm_set1_ps(2.0f)),
+                _mm_and_ps(signsDiffer, _mm_set1_ps(1.0f)));
+            __m128 angle = _mm_add_ps(quadrant, _mm_div_ps(numerator, sum));
+            __m128 position = _mm_add_ps(_mm_mul_ps(angle, scale), _mm_set1_ps(0.5f));
+            __m128i cell = _mm_cvttps_epi32(position);
+            __m128 frac = _mm_sub_ps(position, _mm_cvtepi32_ps(cell));
+            __m128 dist2 = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+            alignas(16) int cells[4];
+            alignas(16) float fracs[4];
+            alignas(16) float dists[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(cells), cell);
+            _mm_store_ps(fracs, frac);
+            _mm_store_ps(dists, dist2);
+            for (int l = 0; l < 4; ++l) {
+                out[x + l] = filteredLookup(cells[l] - 1, fracs[l], dists[l]);
+            }
+        }
+#endif
+        for (; x < count; ++x) {
+            float dx = first.x + step.x * x;
+            float dy = first.y + step.y * x;
+            float position = diamondAngle(dx, dy) * binsPerUnit + 0.5f;
+            int cell = static_cast<int>(position);
+            out[x] = filteredLookup(cell - 1, position - cell, dx * dx + dy * dy);
+        }
+    }
+
+    // One division; the quadrant only selects an offset and a sign.
+    static float diamondAngle(float x, float y) {
+        float ax = std::fabs(x);
+        float ay = std::fabs(y);
+        float sum = ax + ay;
+        if (sum <= 0) return 0.0f;
+        float r = (x >= 0) == (y >= 0) ? ay / sum : ax / sum;
+        float quadrant = y >= 0 ? (x >= 0 ? 0.0f : 1.0f) : (x < 0 ? 2.0f : 3.0f);
+        return quadrant + r;
+    }
+
+private:
+    // Sum over k = -1..1 of lerp(cmp(base + k), cmp(base + k + 1), frac),
+    // which collapses to four comparisons. base is in [-1, n - 1], so the
+    // taps stay within the guard bins and need no wrapping.
+    float filteredLookup(int base, float frac, float dist2) const {
+        const float* d = &storage[guardBins + base];
+        float c0 = dist2 < d[-1] ? 1.0f : 0.0f;
+        float c1 = dist2 < d[0] ? 1.0f : 0.0f;
+        float c2 = dist2 < d[1] ? 1.0f : 0.0f;
+        float c3 = dist2 < d[2] ? 1.0f : 0.0f;
+        return (c0 + c1 + c2 + (c3 - c0) * frac) * (1.0f / 3.0f);
+    }
+
+    float depth(int bin) const { return storage[guardBins + bin]; }
+
+    // Bins near either end are mirrored into the guard bins on the other
+    // side, so filtered lookups across the 0/4 seam read real data.
+    void setDepth(int bin, float value) {
+        int n = resolution();
+        storage[guardBins + bin] = value;
+        if (bin < guardBins) storage[guardBins + n + bin] = value;
+        if (bin >= n - guardBins) storage[bin - (n - guardBins)] = value;
+    }
+
+    static int wrap(int i, int n) {
+        return i < 0 ? i + n : (i >= n ? i - n : i);
+    }
+
+    Vec2 binDirection(int bin) const {
+        float p = (bin + 0.5f) / binsPerUnit;
+        Vec2 dir;
+        if (p < 1) dir = Vec2(1 - p, p);
+        else if (p < 2) dir = Vec2(1 - p, 2 - p);
+        else if (p < 3) dir = Vec2(p - 3, 2 - p);
+        else dir = Vec2(p - 3, p - 4);
+        return dir.normalize();
+    }
+
+    // Moves every stored occluder point into the bins around the new light
+    // position, nearest first. Bins nothing lands in read as unoccluded
+    // until they are refreshed or clamped.
+    void reproject(const Vec2& light) {
+        int n = resolution();
+        scratch.assign(n, farDepth);
+        scratchMeasured.assign(n, 0);
+        for (int bin = 0; bin < n; ++bin) {
+            float d2 = depth(bin);
+            if (d2 >= farDepth || !measured[bin]) continue;
+            float t = std::sqrt(d2) - depthBias;
+            if (t <= 0) continue;
+            Vec2 v = lightPos + binDirection(bin) * t - light;
+            float reach = v.length() + depthBias;
+            int target = static_cast<int>(diamondAngle(v.x, v.y) * binsPerUnit);
+            if (target >= n) target -= n;
+            scratch[target] = std::min(scratch[target], reach * reach);
+            scratchMeasured[target] = 1;
+        }
+        std::copy(scratch.begin(), scratch.end(), storage.begin() + guardBins);
+        measured.swap(scratchMeasured);
+    }
+
+    static constexpr float depthBias = 0.5f;
+    static const int guardBins = 2;
+
+    std::vector<float> storage;
+    std::vector<float> scratch;
+    std::vector<uint8_t> measured;
+    std::vector<uint8_t> scratchMeasured;
+    float binsPerUnit;
+    Vec2 lightPos;
+    float farDepth = -1.0f;
+    int stride = 1;
+    int phase = 0;
+    bool moved = false;
+};
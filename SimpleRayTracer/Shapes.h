@@ -0,0 +1,356 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "Framebuffer.h"
+#include "Geometry.h"
+#include "Vec2.h"
+
+// Screen-space shapes for fillShape() and strokeShape(). Each one gives its
+// bounds, the signed distance from a point to its edge (negative inside),
+// also for four points at once with SSE2, and the interval of x where the
+// horizontal line at height y crosses the shape grown by offset (shrunk for
+// a negative offset). All of them are convex, so that is always a single
+// interval.
+
+// Narrows [x0, x1] to the part of the line at height y where
+// nx * x + ny * y <= c; false when nothing is left.
+inline bool clipToHalfPlane(float nx, float ny, float c, float y, float& x0, float& x1) {
+    float rhs = c - ny * y;
+    if (nx > 1e-6f) x1 = std::min(x1, rhs / nx);
+    else if (nx < -1e-6f) x0 = std::max(x0, rhs / nx);
+    else if (rhs < 0.0f) return false;
+    return x0 <= x1;
+}
+
+struct CircleShape {
+    Vec2 center;
+    float radius;
+
+    Aabb bounds() const { return Aabb::around(center, radius); }
+
+    float distance(float x, float y) const {
+        float dx = x - center.x;
+        float dy = y - center.y;
+        return std::sqrt(dx * dx + dy * dy) - radius;
+    }
+
+#ifdef SRT_SSE2
+    __m128 distance4(__m128 x, __m128 y) const {
+        __m128 dx = _mm_sub_ps(x, _mm_set1_ps(center.x));
+        __m128 dy = _mm_sub_ps(y, _mm_set1_ps(center.y));
+        return _mm_sub_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))), _mm_set1_ps(radius));
+    }
+#endif
+
+    bool span(float y, float offset, float& x0, float& x1) const {
+        float r = radius + offset;
+        float dy = y - center.y;
+        if (r <= 0.0f || dy * dy >= r * r) return false;
+        float halfChord = std::sqrt(r * r - dy * dy);
+        x0 = center.x - halfChord;
+        x1 = center.x + halfChord;
+        return true;
+    }
+};
+
+// Every point within radius of the segment a-b.
+struct CapsuleShape {
+    Vec2 a, b;
+    float radius;
+
+    Aabb bounds() const {
+        return Aabb(Vec2(std::min(a.x, b.x) - radius, std::min(a.y, b.y) - radius),
+                    Vec2(std::max(a.x, b.x) + radius, std::max(a.y, b.y) + radius));
+    }
+
+    float distance(float x, float y) const {
+        Vec2 ab = b - a;
+        Vec2 ap = Vec2(x, y) - a;
+        float lengthSquared = ab.x * ab.x + ab.y * ab.y;
+        float t = lengthSquared > 0.0f ? std::min(std::max((ap.x * ab.x + ap.y * ab.y) / lengthSquared, 0.0f), 1.0f) : 0.0f;
+        return (ap - ab * t).length() - radius;
+    }
+
+#ifdef SRT_SSE2
+    __m128 distance4(__m128 x, __m128 y) const {
+        Vec2 ab = b - a;
+        float lengthSquared = ab.x * ab.x + ab.y * ab.y;
+        __m128 abX = _mm_set1_ps(ab.x);
+        __m128 abY = _mm_set1_ps(ab.y);
+        __m128 apX = _mm_sub_ps(x, _mm_set1_ps(a.x));
+        __m128 apY = _mm_sub_ps(y, _mm_set1_ps(a.y));
+        __m128 t = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(apX, abX), _mm_mul_ps(apY, abY)),
+            _mm_set1_ps(lengthSquared > 0.0f ? 1.0f / lengthSquared : 0.0f));
+        t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        __m128 dx = _mm_sub_ps(apX, _mm_mul_ps(abX, t));
+        __m128 dy = _mm_sub_ps(apY, _mm_mul_ps(abY, t));
+        return _mm_sub_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))), _mm_set1_ps(radius));
+    }
+#endif
+
+    // The two end caps and the rectangle between them together cover the
+    // capsule, and the row crosses it in one interval, so that interval is
+    // the hull of the three pieces' intervals.
+    bool span(float y, float offset, float& x0, float& x1) const {
+        float r = radius + offset;
+        if (r <= 0.0f) return false;
+        bool any = false;
+        float lo, hi;
+        auto merge = [&](float l, float h) {
+            x0 = any ? std::min(x0, l) : l;
+            x1 = any ? std::max(x1, h) : h;
+            any = true;
+        };
+        if (CircleShape{ a, r }.span(y, 0.0f, lo, hi)) merge(lo, hi);
+        if (CircleShape{ b, r }.span(y, 0.0f, lo, hi)) merge(lo, hi);
+
+        Vec2 ab = b - a;
+        float length = ab.length();
+        if (length > 0.0f) {
+            Vec2 t = ab * (1.0f / length);
+            Vec2 n(-t.y, t.x);
+            float na = n.x * a.x + n.y * a.y;
+            float ta = t.x * a.x + t.y * a.y;
+            lo = -1e30f;
+            hi = 1e30f;
+            if (clipToHalfPlane(n.x, n.y, na + r, y, lo, hi) && clipToHalfPlane(-n.x, -n.y, r - na, y, lo, hi) &&
+                clipToHalfPlane(t.x, t.y, ta + length, y, lo, hi) && clipToHalfPlane(-t.x, -t.y, -ta, y, lo, hi)) {
+                merge(lo, hi);
+            }
+        }
+        return any;
+    }
+};
+
+// Convex polygon of up to MaxVertices vertices in either winding, stored as
+// its edges' outward normals and offsets. Distances are to the nearest edge
+// line, so grown outlines get mitred corners, cut off at the bounds.
+struct PolygonShape {
+    static const int MaxVertices = 8;
+
+    Vec2 normals[MaxVertices];
+    float offsets[MaxVertices];
+    int count = 0;
+    Aabb box;
+
+    PolygonShape(const Vec2* points, int n) {
+        n = std::min(n, static_cast<int>(MaxVertices));
+        float area = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            const Vec2& p = points[i];
+            const Vec2& q = points[(i + 1) % n];
+            area += p.x * q.y - q.x * p.y;
+            box.grow(Aabb(p, p));
+        }
+        float winding = area < 0.0f ? -1.0f : 1.0f;
+        for (int i = 0; i < n; ++i) {
+            Vec2 edge = points[(i + 1) % n] - points[i];
+            float length = edge.length();
+            if (length <= 0.0f) continue;
+            Vec2 normal = Vec2(edge.y, -edge.x) * (winding / length);
+            normals[count] = normal;
+            offsets[count] = normal.x * points[i].x + normal.y * points[i].y;
+            ++count;
+        }
+    }
+
+    Aabb bounds() const { return box; }
+
+    float distance(float x, float y) const {
+        float d = -1e30f;
+        for (int i = 0; i < count; ++i) d = std::max(d, normals[i].x * x + normals[i].y * y - offsets[i]);
+        return d;
+    }
+
+#ifdef SRT_SSE2
+    __m128 distance4(__m128 x, __m128 y) const {
+        __m128 d = _mm_set1_ps(-1e30f);
+        for (int i = 0; i < count; ++i) {
+            __m128 e = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(normals[i].x)), _mm_mul_ps(y, _mm_set1_ps(normals[i].y)));
+            d = _mm_max_ps(d, _mm_sub_ps(e, _mm_set1_ps(offsets[i])));
+        }
+        return d;
+    }
+#endif
+
+    bool span(float y, float offset, float& x0, float& x1) const {
+        if (count < 3) return false;
+        x0 = -1e30f;
+        x1 = 1e30f;
+        for (int i = 0; i < count; ++i) {
+            if (!clipToHalfPlane(normals[i].x, normals[i].y, offsets[i] + offset, y, x0, x1)) return false;
+        }
+        return true;
+    }
+};
+
+// Half a pixel diagonal: a pixel whose centre is further than this inside
+// an edge is fully covered, and one further outside is not touched.
+const float pixelReach = 0.70710678f;
+
+// Indices i in [lo, hi) whose pixel centres i + 0.5 lie in [a, b]. The
+// bounds are clamped before converting, so truncation does the rounding
+// without a call to floor or ceil per row.
+inline bool pixelRange(float a, float b, int lo, int hi, int& first, int& end) {
+    float from = std::min(std::max(a - 0.5f, static_cast<float>(lo)), static_cast<float>(hi));
+    float to = std::min(std::max(b + 0.5f, static_cast<float>(lo)), static_cast<float>(hi));
+    first = static_cast<int>(from);
+    if (first < from) ++first;
+    end = static_cast<int>(to);
+    return first < end;
+}
+
+// Blends every pixel of [first, end) on row y with the coverage the shape
+// gives its centre. With SSE2 this goes four column-aligned pixels at a
+// time; lanes outside the range get zero alpha, which leaves their pixel
+// unchanged, so edge runs of any length cost no per-pixel branches.
+// Stroke selects the outline's coverage, halfWidth + 0.5 - |distance|, over
+// the fill's 0.5 - distance.
+template <typename Framebuffer, typename Shape>
+void blendEdgePixels(Framebuffer& fb, int first, int end, int y, const Shape& shape, bool stroke, float halfWidth,
+    uint32_t color, int alpha) {
+    float cy = y + 0.5f;
+    int x = first;
+#ifdef SRT_SSE2
+    const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128i laneIndex = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128 vy = _mm_set1_ps(cy);
+    const __m128 bias = _mm_set1_ps(stroke ? halfWidth + 0.5f : 0.5f);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+    const __m128 scale = _mm_set1_ps(static_cast<float>(alpha));
+    const __m128i before = _mm_set1_epi32(first - 1);
+    const __m128i after = _mm_set1_epi32(end);
+    for (x = first & ~3; x < end; x += 4) {
+        __m128 d = shape.distance4(_mm_add_ps(_mm_set1_ps(static_cast<float>(x)), lane), vy);
+        if (stroke) d = _mm_andnot_ps(signMask, d);
+        __m128 coverage = _mm_min_ps(_mm_max_ps(_mm_sub_ps(bias, d), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        __m128i index = _mm_add_epi32(_mm_set1_epi32(x), laneIndex);
+        __m128i inside = _mm_and_si128(_mm_cmpgt_epi32(index, before), _mm_cmplt_epi32(index, after));
+        fb.blendQuad(x, y, color, _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(coverage, scale)), inside));
+    }
+#endif
+    for (; x < end; ++x) {
+        float d = shape.distance(x + 0.5f, cy);
+        float coverage = stroke ? halfWidth + 0.5f - std::fabs(d) : 0.5f - d;
+        int a = static_cast<int>(std::min(std::max(coverage, 0.0f), 1.0f) * alpha + 0.5f);
+        if (a <= 0) continue;
+        uint32_t& p = fb.at(x, y);
+        p = blendColor(p, color, a);
+    }
+}
+
+// The interior interval [first, end) of a row, shrunk to whole quads of
+// four so it splits the row into edge runs that do not share a quad.
+inline void alignInterior(int& first, int& end) {
+#ifdef SRT_SSE2
+    first = (first + 3) & ~3;
+    end &= ~3;
+    if (first >= end) first = end;
+#endif
+}
+
+// Shapes at most this many pixels across are drawn by evaluating every
+// pixel of their bounds; working out the edge and interior runs of each row
+// costs more than it saves on a handful of quads.
+const int smallShapePixels = 12;
+
+// Pixel columns and rows of fb within [y0, y1) that can be within reach of
+// shape. Returns false if there are none; small says whether the shape is
+// narrow enough to draw from its bounds alone.
+template <typename Framebuffer, typename Shape>
+bool shapeExtent(const Framebuffer& fb, const Shape& shape, float reach, int& x0, int& x1, int& y0, int& y1, bool& small) {
+    Aabb box = shape.bounds();
+    if (!pixelRange(box.min.y - reach, box.max.y + reach, std::max(y0, 0), std::min(y1, fb.getHeight()), y0, y1)) return false;
+    if (!pixelRange(box.min.x - reach, box.max.x + reach, 0, fb.getWidth(), x0, x1)) return false;
+    small = box.max.x - box.min.x <= smallShapePixels;
+    return true;
+}
+
+// Anti-aliased fill of shape over rows [y0, y1) of fb. Each row's pixels
+// well inside the edge are blended as one solid span; only those within
+// pixelReach of the edge evaluate the distance, taking 0.5 - distance as
+// their coverage.
+template <typename Framebuffer, typename Shape>
+void fillShape(Framebuffer& fb, int y0, int y1, const Shape& shape, uint32_t color, int alpha) {
+    int x0, x1;
+    bool small;
+    if (!shapeExtent(fb, shape, pixelReach, x0, x1, y0, y1, small)) return;
+    if (small) {
+        for (int y = y0; y < y1; ++y) blendEdgePixels(fb, x0, x1, y, shape, false, 0.0f, color, alpha);
+        return;
+    }
+    for (int y = y0; y < y1; ++y) {
+        float cy = y + 0.5f;
+        float outer0, outer1, inner0, inner1;
+        int first, end;
+        if (!shape.span(cy, pixelReach, outer0, outer1) || !pixelRange(outer0, outer1, 0, fb.getWidth(), first, end)) continue;
+        int innerFirst = end;
+        int innerEnd = end;
+        if (shape.span(cy, -pixelReach, inner0, inner1) && pixelRange(inner0, inner1, first, end, innerFirst, innerEnd)) {
+            alignInterior(innerFirst, innerEnd);
+        }
+        else {
+            innerFirst = innerEnd = end;
+        }
+        blendEdgePixels(fb, first, innerFirst, y, shape, false, 0.0f, color, alpha);
+        if (innerFirst < innerEnd) fb.blendSpan(innerFirst, innerEnd, y, color, alpha);
+        blendEdgePixels(fb, innerEnd, end, y, shape, false, 0.0f, color, alpha);
+    }
+}
+
+// Anti-aliased outline of the given width centred on the shape's edge. The
+// interior the stroke cannot reach is skipped on every row.
+template <typename Framebuffer, typename Shape>
+void strokeShape(Framebuffer& fb, int y0, int y1, const Shape& shape, float width, uint32_t color, int alpha) {
+    float half = width * 0.5f;
+    int x0, x1;
+    bool small;
+    if (!shapeExtent(fb, shape, half + pixelReach, x0, x1, y0, y1, small)) return;
+    if (small) {
+        for (int y = y0; y < y1; ++y) blendEdgePixels(fb, x0, x1, y, shape, true, half, color, alpha);
+        return;
+    }
+    for (int y = y0; y < y1; ++y) {
+        float cy = y + 0.5f;
+        float outer0, outer1, hole0, hole1;
+        int first, end;
+        if (!shape.span(cy, half + pixelReach, outer0, outer1) || !pixelRange(outer0, outer1, 0, fb.getWidth(), first, end)) continue;
+        int holeFirst = end;
+        int holeEnd = end;
+        if (shape.span(cy, -(half + pixelReach), hole0, hole1) && pixelRange(hole0, hole1, first, end, holeFirst, holeEnd)) {
+            alignInterior(holeFirst, holeEnd);
+        }
+        else {
+            holeFirst = holeEnd = end;
+        }
+        blendEdgePixels(fb, first, holeFirst, y, shape, true, half, color, alpha);
+        blendEdgePixels(fb, holeEnd, end, y, shape, true, half, color, alpha);
+    }
+}
+
+// A point under a pixel across, spread over the four pixels nearest to it
+// with bilinear weights; far cheaper than a shape for the many sub-pixel
+// occluders of a zoomed-out scene.
+template <typename Framebuffer>
+void splatPoint(Framebuffer& fb, int y0, int y1, const Vec2& p, uint32_t color, int alpha) {
+    float fx = p.x - 0.5f;
+    float fy = p.y - 0.5f;
+    if (fx < -1.0f || fy < -1.0f || fx >= fb.getWidth() || fy >= fb.getHeight()) return;
+    int x = static_cast<int>(fx + 1.0f) - 1;
+    int y = static_cast<int>(fy + 1.0f) - 1;
+    float wx = fx - x;
+    float wy = fy - y;
+    const float weights[4] = { (1 - wx) * (1 - wy), wx * (1 - wy), (1 - wx) * wy, wx * wy };
+    for (int i = 0; i < 4; ++i) {
+        int px = x + (i & 1);
+        int py = y + (i >> 1);
+        if (px < 0 || px >= fb.getWidth() || py < std::max(y0, 0) || py >= std::min(y1, fb.getHeight())) continue;
+        int a = static_cast<int>(weights[i] * alpha + 0.5f);
+        if (a <= 0) continue;
+        uint32_t& pixel = fb.at(px, py);
+        pixel = blendColor(pixel, color, a);
+    }
+}
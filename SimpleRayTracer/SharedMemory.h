@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A named block of memory mapped into every process that opens it: a POSIX
+// shm_open() object, or a pagefile-backed file mapping in the session's
+// Local\ namespace on Windows. The creator owns the name and removes it on
+// destruction; processes that still have it mapped keep their mapping.
+// Creating a name another live creator owns fails on both: on POSIX the
+// creator holds an advisory lock on the object, which the OS drops if it
+// crashes, so a region it left behind is taken over instead. Move-only.
+class SharedMemory {
+public:
+    SharedMemory() {}
+    SharedMemory(SharedMemory&& other) { *this = std::move(other); }
+    SharedMemory& operator=(SharedMemory&& other) {
+        if (this != &other) {
+            close();
+            data = other.data;
+            size = other.size;
+            name = std::move(other.name);
+            owner = other.owner;
+#ifdef _WIN32
+            mapping = other.mapping;
+            other.mapping = nullptr;
+#else
+            lock = other.lock;
+            other.lock = -1;
+#endif
+            other.data = nullptr;
+            other.size = 0;
+            other.owner = false;
+        }
+        return *this;
+    }
+    SharedMemory(const SharedMemory&) = delete;
+    SharedMemory& operator=(const SharedMemory&) = delete;
+    ~SharedMemory() { close(); }
+
+    // Creates size zeroed bytes under name; fails while another creator of
+    // the name is running.
+    static SharedMemory create(const char* name, size_t size) {
+        SharedMemory region;
+        std::string path = qualify(name);
+#ifdef _WIN32
+        unsigned long long wide = size;
+        region.mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(wide >> 32), static_cast<DWORD>(wide), path.c_str());
+        if (!region.mapping) return region;
+        if (GetLastError() == ERROR_ALREADY_EXISTS) {
+            // Another server is still running under this name.
+            region.close();
+            return region;
+        }
+        region.data = MapViewOfFile(region.mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+        int fd = shm_open(path.c_str(), O_RDWR | O_CREAT, 0600);
+        if (fd < 0) return region;
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+            // Another server is still running under this name.
+            ::close(fd);
+            return region;
+        }
+        // Truncating first zeroes whatever a crashed creator left.
+        if (ftruncate(fd, 0) == 0 && ftruncate(fd, static_cast<off_t>(size)) == 0) {
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) region.data = p;
+        }
+        if (region.data) {
+            region.lock = fd;
+        }
+        else {
+            shm_unlink(path.c_str());
+            ::close(fd);
+        }
+#endif
+        if (region.data) {
+            region.size = size;
+            region.name = path;
+            region.owner = true;
+        }
+        return region;
+    }
+
+    // Maps a region another process created.
+    static SharedMemory open(const char* name) {
+        SharedMemory region;
+        std::string path = qualify(name);
+#ifdef _WIN32
+        region.mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, path.c_str());
+        if (!region.mapping) return region;
+        region.data = MapViewOfFile(region.mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        MEMORY_BASIC_INFORMATION info;
+        if (region.data && VirtualQuery(region.data, &info, sizeof(info))) region.size = info.RegionSize;
+#else
+        int fd = shm_open(path.c_str(), O_RDWR, 0);
+        if (fd < 0) return region;
+        struct stat status;
+        if (fstat(fd, &status) == 0 && status.st_size > 0) {
+            size_t size = static_cast<size_t>(status.st_size);
+            void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p != MAP_FAILED) {
+                region.data = p;
+                region.size = size;
+            }
+        }
+        ::close(fd);
+#endif
+        region.name = path;
+        return region;
+    }
+
+    bool valid() const { return data != nullptr; }
+    void* get() const { return data; }
+    size_t getSize() const { return size; }
+
+    void close() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        mapping = nullptr;
+#else
+        if (data) munmap(data, size);
+        if (owner) shm_unlink(name.c_str());
+        if (lock >= 0) ::close(lock);
+        lock = -1;
+#endif
+        data = nullptr;
+        size = 0;
+        owner = false;
+    }
+
+private:
+    static std::string qualify(const char* name) {
+#ifdef _WIN32
+        return std::string("Local\\") + name;
+#else
+        return std::string("/") + name;
+#endif
+    }
+
+    void* data = nullptr;
+    size_t size = 0;
+    std::string name;
+    bool owner = false;
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#else
+    // The creator's descriptor, holding the lock.
+    int lock = -1;
+#endif
+};
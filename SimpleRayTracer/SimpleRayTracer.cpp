@@ -1,130 +1,2207 @@
 #include <SDL.h>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
 #include <vector>
 
-struct Vec2 {
-    float x, y;
-    Vec2(float x = 0, float y = 0) : x(x), y(y) {}
+#include "AcceleratorCache.h"
+#include "AllocationTracker.h"
+#include "Camera.h"
+#include "Coverage.h"
+#include "FrameArena.h"
+#include "FrameStream.h"
+#include "Framebuffer.h"
+#include "MappedFile.h"
+#include "QualityController.h"
+#include "RayHistory.h"
+#include "RayService.h"
+#include "RenderFarm.h"
+#include "Scene.h"
+#include "SdlBatch.h"
+#include "ShadowMap.h"
+#include "Shapes.h"
+#include "ThreadPool.h"
+#include "Vec2.h"
 
-    Vec2 operator+(const Vec2& v) const { return Vec2(x + v.x, y + v.y); }
-    Vec2 operator-(const Vec2& v) const { return Vec2(x - v.x, y - v.y); }
-    Vec2 operator*(float s) const { return Vec2(x * s, y * s); }
+#ifdef SRT_PROFILE
+void* operator new(size_t size) {
+    AllocationTracker::recordAllocation(size);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+#endif
+
+Scene scene = Scene::makeDefault();
+Camera camera;
+int draggedLight = -1;
+
+// Occluder clusters smaller than this many pixels are traced, shadowed and
+// drawn as a single merged circle; a zero threshold disables LOD. The pixel
+// scale follows the camera zoom.
+LodSettings lod{ 1.0f, 1.0f };
+
+const LodSettings* activeLod() {
+    return lod.maxErrorPixels > 0 ? &lod : nullptr;
+}
+
+// Fraction of the output resolution the CPU framebuffer is rendered at; the
+// texture is stretched back up to the window when presented.
+float renderScale = 1.0f;
+
+int scaledSize(int size) {
+    return std::max(1, static_cast<int>(size * renderScale + 0.5f));
+}
+
+// Frame budget for the adaptive quality controller; 0 keeps the ray count
+// and render scale fixed. Negative means not set on the command line.
+double targetFrameMs = -1.0;
+
+// Rays are drawn as the integer DDA lines of blendLine() by default, or as
+// anti-aliased coverage with --antialias-rays.
+bool antialiasRays = false;
+
+// A moving light re-traces one in this many of its rays and shadow map bins
+// each frame and takes the rest from its reprojected history; 1 rebuilds
+// everything every frame.
+int accumulationFrames = 4;
+
+double millisecondsSince(Uint64 start) {
+    return static_cast<double>(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
 
-    float length() const { return std::sqrt(x * x + y * y); }
-    Vec2 normalize() const {
-        float len = length();
-        return len > 0 ? Vec2(x / len, y / len) : *this;
+struct RayHit {
+    Vec2 end;
+    Vec2 screenEnd;
+    bool hit;
+};
+
+// Per-light data kept from one frame to the next. The shadow map remembers
+// what it was built for so a light that has not moved keeps it.
+struct LightState {
+    ShadowMap1D shadowMap;
+    RayHistory rays;
+    Vec2 shadowOrigin;
+    float shadowRadius = -1.0f;
+    float shadowLodScale = -1.0f;
+
+    explicit LightState(int shadowResolution) : shadowMap(shadowResolution) {}
+};
+
+// Everything the draw stage needs about one light for the current frame.
+struct LightFrame {
+    const Light* light;
+    ShadowMap1D* shadowMap;
+    RayHit* hits;
+    int numRays;
+    Vec2 screenPos;
+    float screenRadius;
+};
+
+const uint32_t backgroundColor = packColor(30, 30, 30);
+const uint32_t rayColor = packColor(255, 255, 0);
+const uint32_t lightColor = packColor(255, 240, 170);
+const uint32_t occluderColor = packColor(0, 120, 200);
+
+// Shapes drawn over the lighting, in render target pixels: an outline for
+// every occluder in view (a point for those under a pixel across) and a
+// ring around every light.
+struct OverlayFrame {
+    const CircleShape* occluders;
+    int occluderCount;
+    const CircleShape* markers;
+    int markerCount;
+    float strokeWidth;
+};
+
+// Only circles inside the view are visited, and with LOD on, whole clusters
+// under a pixel come back as one proxy. occluders keeps its capacity from
+// frame to frame.
+OverlayFrame collectOverlay(const Scene& scene, const Camera& camera, const LightFrame* frames, int count,
+    float markerRadius, float strokeWidth, std::vector<CircleShape>& occluders) {
+    // An outline reaches half its stroke plus a pixel of anti-aliasing
+    // outside its circle, so circles just off screen can still show.
+    Aabb view = camera.visibleBounds();
+    Vec2 margin = Vec2(1, 1) * ((strokeWidth * 0.5f + 1.0f) / camera.zoom);
+    view = Aabb(view.min - margin, view.max + margin);
+    occluders.clear();
+    scene.bvh.query(view, [&](const Circle& circle) {
+        occluders.push_back(CircleShape{ camera.worldToScreen(circle.center), circle.radius * camera.zoom });
+    }, activeLod());
+
+    CircleShape* markers = FrameArena::forThisThread().allocArray<CircleShape>(count);
+    for (int l = 0; l < count; ++l) markers[l] = CircleShape{ frames[l].screenPos, markerRadius };
+    return OverlayFrame{ occluders.data(), static_cast<int>(occluders.size()), markers, count, strokeWidth };
+}
+
+template <typename Framebuffer>
+void drawOverlay(Framebuffer& fb, const OverlayFrame& overlay, int y0, int y1) {
+    // Most occluders miss the band; the test up front is cheaper than
+    // clipping each one.
+    float top = y0 - overlay.strokeWidth - 1.0f;
+    float bottom = y1 + overlay.strokeWidth + 1.0f;
+    for (int i = 0; i < overlay.occluderCount; ++i) {
+        const CircleShape& circle = overlay.occluders[i];
+        if (circle.center.y + circle.radius < top || circle.center.y - circle.radius > bottom) continue;
+        if (circle.radius < 1.0f) splatPoint(fb, y0, y1, circle.center, occluderColor, 255);
+        else strokeShape(fb, y0, y1, circle, overlay.strokeWidth, occluderColor, 255);
+    }
+    for (int i = 0; i < overlay.markerCount; ++i) {
+        strokeShape(fb, y0, y1, overlay.markers[i], overlay.strokeWidth, rayColor, 255);
     }
+}
+
+// Rays stop at the light's radius: beyond it the light contributes nothing,
+// and the BVH traversal prunes every node that starts further out. Only the
+// rays the history asks for are traced; the rest are reused.
+void traceRays(const Scene& scene, const Camera& camera, const Light& light, RayHistory& history,
+    int numRays, RayHit* hits) {
+    history.begin(light.position, light.radius, numRays, accumulationFrames, activeLod() ? lod.pixelsPerUnit : 0.0f);
+    auto trace = [&](int i) {
+        float angle = 2 * M_PI * i / numRays;
+        Vec2 dir(std::cos(angle), std::sin(angle));
+        float t;
+        bool hit = scene.intersect(light.position, dir, light.radius, t, activeLod());
+        history.store(i, hit ? t : light.radius);
+    };
+    for (int i = 0; i < numRays; ++i) {
+        if (history.needsTrace(i)) trace(i);
+    }
+    for (int i = 0; i < numRays; ++i) {
+        if (history.needsRetrace(i)) trace(i);
+    }
+
+    for (int i = 0; i < numRays; ++i) {
+        float angle = 2 * M_PI * i / numRays;
+        float distance = history.distance(i);
+        hits[i].hit = distance < light.radius;
+        hits[i].end = light.position + Vec2(std::cos(angle), std::sin(angle)) * distance;
+        hits[i].screenEnd = camera.worldToScreen(hits[i].end);
+    }
+}
+
+// Only occluders inside the light's circle of influence reach the map.
+// Occluders never move, so the map only changes with the light or with the
+// LOD scale; a light that only moved gets a partial, reprojected update.
+void buildShadowMap(const Scene& scene, const Light& light, LightState& state) {
+    bool sameOrigin = state.shadowOrigin.x == light.position.x && state.shadowOrigin.y == light.position.y;
+    bool sameShape = state.shadowRadius == light.radius && state.shadowLodScale == lod.pixelsPerUnit;
+    if (sameOrigin && sameShape) return;
+    state.shadowOrigin = light.position;
+    state.shadowRadius = light.radius;
+    state.shadowLodScale = lod.pixelsPerUnit;
+
+    if (sameShape) state.shadowMap.beginUpdate(light.position, light.radius, accumulationFrames);
+    else state.shadowMap.clear(light.position, light.radius);
+    scene.bvh.query(light.influence(), [&](const Circle& circle) {
+        state.shadowMap.addCircle(circle.center, circle.radius);
+    }, activeLod());
+    state.shadowMap.resolveUpdate();
+}
+
+// Small lights get proportionally fewer angular bins.
+int shadowMapResolutionFor(const Light& light) {
+    int resolution = 256;
+    while (resolution < 8192 && resolution < 2 * M_PI * light.radius * 2) resolution *= 2;
+    return resolution;
+}
+
+std::vector<LightState> makeLightStates(const Scene& scene) {
+    std::vector<LightState> states;
+    states.reserve(scene.lights.size());
+    for (const Light& light : scene.lights) states.emplace_back(shadowMapResolutionFor(light));
+    return states;
+}
+
+// Traces every light whose influence reaches the camera's view and fills in
+// frames[]; returns how many lights were kept.
+int traceFrame(ThreadPool& pool, const Scene& scene, std::vector<LightState>& states,
+    const Camera& camera, int numRays, LightFrame* frames) {
+    FrameArena& arena = FrameArena::forThisThread();
+    Aabb viewport = camera.visibleBounds();
+    int count = 0;
+    LightState** frameStates = arena.allocArray<LightState*>(scene.lights.size());
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        if (!scene.lights[i].influence().overlaps(viewport)) continue;
+        frameStates[count] = &states[i];
+        LightFrame& frame = frames[count++];
+        frame.light = &scene.lights[i];
+        frame.shadowMap = &states[i].shadowMap;
+        frame.hits = arena.allocArray<RayHit>(numRays);
+        frame.numRays = numRays;
+        frame.screenPos = camera.worldToScreen(scene.lights[i].position);
+        frame.screenRadius = scene.lights[i].radius * camera.zoom;
+    }
+
+    pool.parallelFor(count, [&](int i) {
+        LightFrame& frame = frames[i];
+        traceRays(scene, camera, *frame.light, frameStates[i]->rays, frame.numRays, frame.hits);
+        buildShadowMap(scene, *frame.light, *frameStates[i]);
+    });
+    return count;
+}
+
+// Per-pixel lighting for one light within rows [y0, y1): windowed falloff,
+// masked by one filtered lookup into the light's angular shadow map. Each
+// row only visits the on-screen chord of the light's circle of influence,
+// and walks it in world space one camera pixel step at a time.
+template <typename Framebuffer>
+void shadeLight(Framebuffer& fb, const Camera& camera, const LightFrame& frame, int y0, int y1) {
+    const Light& light = *frame.light;
+    const Vec2 center = frame.screenPos;
+    const float radius = frame.screenRadius;
+    y0 = std::max(y0, static_cast<int>(std::max(center.y - radius, -1.0f)));
+    y1 = std::min(y1, static_cast<int>(std::min(center.y + radius, 1e9f)) + 1);
+    if (y0 >= y1) return;
+
+    const Vec2 stepX = camera.pixelStepX();
+    const Vec2 stepY = camera.pixelStepY();
+    const Vec2 firstPixel = camera.screenToWorld(Vec2(0.5f, 0.5f));
+    float* visibility = FrameArena::forThisThread().allocArray<float>(fb.getWidth());
+    for (int y = y0; y < y1; ++y) {
+        float dy = y + 0.5f - center.y;
+        if (dy * dy >= radius * radius) continue;
+        float halfChord = std::sqrt(radius * radius - dy * dy);
+        int x0 = static_cast<int>(std::min(std::max(center.x - halfChord, 0.0f), static_cast<float>(fb.getWidth())));
+        int x1 = static_cast<int>(std::min(center.x + halfChord + 1.0f, static_cast<float>(fb.getWidth())));
+        if (x0 >= x1) continue;
+
+        Vec2 start = firstPixel + stepY * static_cast<float>(y) + stepX * static_cast<float>(x0);
+        frame.shadowMap->visibilityRow(start, stepX, x1 - x0, visibility);
+        Vec2 offset = start - light.position;
+        for (int x = x0; x < x1; ++x) {
+            Vec2 d = offset + stepX * static_cast<float>(x - x0);
+            float intensity = light.falloff(d.x * d.x + d.y * d.y) * visibility[x - x0];
+            if (intensity <= 0.0f) continue;
+            uint32_t& p = fb.at(x, y);
+            p = blendColor(p, lightColor, static_cast<int>(intensity * 255.0f));
+        }
+    }
+}
+
+// Work is split into horizontal bands of whole tile rows, so in the tiled
+// layout each thread writes only to tiles it owns. Tall bands keep the
+// per-band clipping overhead low; small images get thinner bands so every
+// thread still has something to do.
+template <typename Framebuffer>
+int bandHeightFor(const ThreadPool& pool, const Framebuffer& fb) {
+    int rows = fb.getHeight() / (pool.size() * 2);
+    rows -= rows % Framebuffer::TileSize;
+    if (rows < Framebuffer::TileSize) rows = Framebuffer::TileSize;
+    return rows < Framebuffer::TileSize * 16 ? rows : Framebuffer::TileSize * 16;
+}
+
+// Rays binned by the bands their segments cross: band b's rays are
+// rays[start[b]] up to rays[start[b + 1]], numbered across all lights in
+// order, so each light's rays in a band are one run. Allocated from the
+// calling thread's frame arena.
+struct BandRays {
+    int* start;
+    int* rays;
 };
 
-Vec2 lightPos(400, 300);
-Vec2 sphereCenter(400, 300);
-float sphereRadius = 50.0f;
-bool draggingLight = false;
+template <typename Framebuffer>
+BandRays binRaysByBand(const Framebuffer& fb, const LightFrame* frames, int count, int bandHeight, int bands) {
+    FrameArena& arena = FrameArena::forThisThread();
+    BandRays binned{ arena.allocArray<int>(bands + 1), nullptr };
+    // First and last band of each ray, a pixel of anti-aliasing either side;
+    // -1 for rays off the framebuffer.
+    auto span = [&](const LightFrame& frame, const RayHit& hit, int& first, int& last) {
+        float top = std::min(frame.screenPos.y, hit.screenEnd.y) - 1.0f;
+        float bottom = std::max(frame.screenPos.y, hit.screenEnd.y) + 1.0f;
+        if (bottom < 0.0f || top >= fb.getHeight()) {
+            first = last = -1;
+            return;
+        }
+        first = static_cast<int>(std::max(top, 0.0f)) / bandHeight;
+        last = static_cast<int>(std::min(bottom, fb.getHeight() - 1.0f)) / bandHeight;
+    };
+
+    std::fill(binned.start, binned.start + bands + 1, 0);
+    for (int l = 0; l < count; ++l) {
+        for (int i = 0; i < frames[l].numRays; ++i) {
+            int first, last;
+            span(frames[l], frames[l].hits[i], first, last);
+            for (int b = first; b >= 0 && b <= last; ++b) ++binned.start[b + 1];
+        }
+    }
+    for (int b = 0; b < bands; ++b) binned.start[b + 1] += binned.start[b];
+
+    int* next = arena.allocArray<int>(bands);
+    std::copy(binned.start, binned.start + bands, next);
+    binned.rays = arena.allocArray<int>(binned.start[bands]);
+    for (int l = 0, ray = 0; l < count; ++l) {
+        for (int i = 0; i < frames[l].numRays; ++i, ++ray) {
+            int first, last;
+            span(frames[l], frames[l].hits[i], first, last);
+            for (int b = first; b >= 0 && b <= last; ++b) binned.rays[next[b]++] = ray;
+        }
+    }
+    return binned;
+}
+
+// Lights whose influence misses a band are skipped for that band entirely,
+// and a band only draws the rays binned into it. Anti-aliased rays from all
+// lights accumulate into one coverage buffer per band, which is blended
+// over the shading once at the end, before the overlay if there is one.
+template <typename Framebuffer>
+void renderFrame(ThreadPool& pool, Framebuffer& fb, const Camera& camera, const LightFrame* frames, int count,
+    bool shade, const OverlayFrame* overlay = nullptr) {
+    const int bandHeight = bandHeightFor(pool, fb);
+    int bands = (fb.getHeight() + bandHeight - 1) / bandHeight;
+    BandRays binned = binRaysByBand(fb, frames, count, bandHeight, bands);
+    int* firstRay = FrameArena::forThisThread().allocArray<int>(count + 1);
+    firstRay[0] = 0;
+    for (int l = 0; l < count; ++l) firstRay[l + 1] = firstRay[l] + frames[l].numRays;
 
-bool intersect(const Vec2& rayOrigin, const Vec2& rayDir, float& t) {
-    Vec2 oc = rayOrigin - sphereCenter;
-    float a = rayDir.x * rayDir.x + rayDir.y * rayDir.y;
-    float b = 2.0f * (oc.x * rayDir.x + oc.y * rayDir.y);
-    float c = oc.x * oc.x + oc.y * oc.y - sphereRadius * sphereRadius;
-    float discriminant = b * b - 4 * a * c;
+    pool.parallelFor(bands, [&](int band) {
+        int y0 = band * bandHeight;
+        int y1 = std::min(y0 + bandHeight, fb.getHeight());
+        fb.clearRows(y0, y1, backgroundColor);
+
+        CoverageBand coverage{ nullptr, fb.getWidth(), y0, y1 };
+        if (antialiasRays) {
+            coverage.data = FrameArena::forThisThread().allocArray<float>(static_cast<size_t>(fb.getWidth()) * (y1 - y0));
+            coverage.clear();
+        }
 
-    if (discriminant < 0) return false;
+        const int* ray = binned.rays + binned.start[band];
+        const int* rayEnd = binned.rays + binned.start[band + 1];
+        for (int l = 0; l < count; ++l) {
+            const LightFrame& frame = frames[l];
+            // This light's rays in the band.
+            const int* first = ray;
+            while (ray < rayEnd && *ray < firstRay[l + 1]) ++ray;
+            if (frame.screenPos.y + frame.screenRadius < y0 || frame.screenPos.y - frame.screenRadius >= y1) continue;
+            if (shade) shadeLight(fb, camera, frame, y0, y1);
+
+            if (antialiasRays) {
+                for (const int* r = first; r < ray; ++r) {
+                    const RayHit& hit = frame.hits[*r - firstRay[l]];
+                    accumulateLine(coverage, frame.screenPos.x, frame.screenPos.y, hit.screenEnd.x, hit.screenEnd.y,
+                        hit.hit ? 100.0f / 255.0f : 50.0f / 255.0f);
+                }
+                continue;
+            }
 
-    t = (-b - std::sqrt(discriminant)) / (2.0f * a);
-    return t > 0.001f;
+            int ox = static_cast<int>(frame.screenPos.x);
+            int oy = static_cast<int>(frame.screenPos.y);
+            for (const int* r = first; r < ray; ++r) {
+                const RayHit& hit = frame.hits[*r - firstRay[l]];
+                blendLine(fb, ox, oy, static_cast<int>(hit.screenEnd.x), static_cast<int>(hit.screenEnd.y),
+                    rayColor, hit.hit ? 100 : 50, y0, y1);
+            }
+        }
+
+        if (antialiasRays) resolveCoverage(fb, coverage, rayColor);
+        if (overlay) drawOverlay(fb, *overlay, y0, y1);
+    });
 }
 
-void drawCircle(SDL_Renderer* renderer, Vec2 center, float radius) {
-    const int segments = 32;
-    for (int i = 0; i < segments; ++i) {
-        float angle1 = 2 * M_PI * i / segments;
-        float angle2 = 2 * M_PI * (i + 1) / segments;
+template <typename Framebuffer>
+void copyToLinear(ThreadPool& pool, const Framebuffer& fb, void* dst, int pitch) {
+    const int bandHeight = bandHeightFor(pool, fb);
+    int bands = (fb.getHeight() + bandHeight - 1) / bandHeight;
+    pool.parallelFor(bands, [&](int band) {
+        int y1 = (band + 1) * bandHeight;
+        fb.copyRowsToLinear(band * bandHeight, y1 < fb.getHeight() ? y1 : fb.getHeight(), dst, pitch);
+    });
+}
 
-        SDL_RenderDrawLine(renderer,
-            static_cast<int>(center.x + radius * cos(angle1)),
-            static_cast<int>(center.y + radius * sin(angle1)),
-            static_cast<int>(center.x + radius * cos(angle2)),
-            static_cast<int>(center.y + radius * sin(angle2))
-        );
+void presentFramebuffer(ThreadPool& pool, const TiledFramebuffer& fb, SDL_Texture* texture) {
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0) return;
+    copyToLinear(pool, fb, pixels, pitch);
+    SDL_UnlockTexture(texture);
+}
+
+// The framebuffer holds opaque ARGB8888, which RGB888 stores identically
+// with the alpha byte ignored. If the renderer supports neither natively,
+// SDL converts every frame on unlock, so that is worth a warning.
+Uint32 streamingFormat(SDL_Renderer* renderer) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) != 0) return SDL_PIXELFORMAT_ARGB8888;
+    for (Uint32 i = 0; i < info.num_texture_formats; ++i) {
+        Uint32 format = info.texture_formats[i];
+        if (format == SDL_PIXELFORMAT_ARGB8888 || format == SDL_PIXELFORMAT_RGB888) return format;
     }
+    SDL_Log("renderer %s has no native ARGB8888 textures; frames are converted on upload", info.name);
+    return SDL_PIXELFORMAT_ARGB8888;
 }
 
-int main(int argc, char** argv) {
+// Rays fanning out from the centre of a width x height image, alternating
+// hits at half length with misses that reach the corners.
+std::vector<RayHit> makeBenchmarkRays(int width, int height, int numRays) {
+    std::vector<RayHit> hits(numRays);
+    Vec2 origin(width * 0.5f, height * 0.5f);
+    float reach = Vec2(static_cast<float>(width), static_cast<float>(height)).length() * 0.5f;
+    for (int i = 0; i < numRays; ++i) {
+        float angle = 2 * M_PI * i / numRays;
+        hits[i].hit = (i & 1) != 0;
+        hits[i].end = origin + Vec2(std::cos(angle), std::sin(angle)) * (hits[i].hit ? reach * 0.5f : reach);
+        hits[i].screenEnd = hits[i].end;
+    }
+    return hits;
+}
+
+template <typename Framebuffer>
+double benchFramebufferLayout(ThreadPool& pool, int width, int height, int numRays, int frames) {
+    Framebuffer fb;
+    fb.resize(width, height);
+    std::vector<uint32_t> target(static_cast<size_t>(width) * height);
+    std::vector<RayHit> hits = makeBenchmarkRays(width, height, numRays);
+
+    Vec2 origin(width * 0.5f, height * 0.5f);
+    float reach = Vec2(static_cast<float>(width), static_cast<float>(height)).length() * 0.5f;
+    Light light{ origin, reach, 0.0f };
+    LightFrame frame{ &light, nullptr, hits.data(), numRays, origin, reach };
+    Camera identity;
+    identity.screenSize = Vec2(static_cast<float>(width), static_cast<float>(height));
+    identity.center = origin;
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < frames; ++i) {
+        renderFrame(pool, fb, identity, &frame, 1, false);
+        copyToLinear(pool, fb, target.data(), width * 4);
+    }
+    double seconds = static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    return seconds * 1000.0 / frames;
+}
+
+// Compares the row-major and tiled layouts for clear + ray splatting +
+// conversion to a row-major target, at 4K and 8K.
+int runFramebufferBenchmark() {
+    ThreadPool pool;
+    const int sizes[][2] = { { 3840, 2160 }, { 7680, 4320 } };
+    const int numRays = 4096;
+    const int frames = 20;
+
+    SDL_Log("framebuffer benchmark: %d rays, %d threads", numRays, pool.size());
+    for (const auto& size : sizes) {
+        double tiled = benchFramebufferLayout<TiledFramebuffer>(pool, size[0], size[1], numRays, frames);
+        double linear = benchFramebufferLayout<LinearFramebuffer>(pool, size[0], size[1], numRays, frames);
+        SDL_Log("%dx%d: linear %.2f ms, tiled %.2f ms (%.2fx)",
+            size[0], size[1], linear, tiled, linear / tiled);
+    }
+    return 0;
+}
+
+// Per-frame cost of drawing numRays rays with SDL_RenderDrawLine, one draw
+// colour change and line per ray, including the present. The renderer is
+// created without vsync.
+double benchSdlLines(SDL_Renderer* renderer, const std::vector<RayHit>& hits, Vec2 origin, int frames) {
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int f = 0; f < frames; ++f) {
+        SDL_SetRenderDrawColor(renderer, 30, 30, 30, 255);
+        SDL_RenderClear(renderer);
+        for (const RayHit& hit : hits) {
+            SDL_SetRenderDrawColor(renderer, 255, 255, 0, hit.hit ? 100 : 50);
+            SDL_RenderDrawLine(renderer, static_cast<int>(origin.x), static_cast<int>(origin.y),
+                static_cast<int>(hit.screenEnd.x), static_cast<int>(hit.screenEnd.y));
+        }
+        SDL_RenderPresent(renderer);
+    }
+    return millisecondsSince(start) / frames;
+}
+
+// Compares SDL's line drawing with the framebuffer's integer and
+// anti-aliased ray paths (render plus conversion to a row-major image).
+// Without an accelerated renderer, e.g. with no display, SDL's software
+// renderer drawing into a surface stands in.
+int runLineBenchmark() {
+    ThreadPool pool;
+    const int sizes[][2] = { { 800, 600 }, { 1920, 1080 } };
+    const int rayCounts[] = { 10000, 40000 };
+    const int frames = 20;
+
+    const bool antialiased = antialiasRays;
+
     SDL_Init(SDL_INIT_VIDEO);
+    SDL_Log("line benchmark: %d threads", pool.size());
+    for (const auto& size : sizes) {
+        int width = size[0];
+        int height = size[1];
+        SDL_Window* window = SDL_CreateWindow("line benchmark", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+            width, height, SDL_WINDOW_HIDDEN);
+        SDL_Renderer* renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED) : nullptr;
+        SDL_Surface* surface = nullptr;
+        if (!renderer) {
+            surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+            renderer = surface ? SDL_CreateSoftwareRenderer(surface) : nullptr;
+        }
+        SDL_RendererInfo info;
+        if (renderer) {
+            SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+            if (SDL_GetRendererInfo(renderer, &info) != 0) info.name = "unknown";
+        }
 
-    SDL_Window* window = SDL_CreateWindow("Interactive Raytracer",
-        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        800, 600, SDL_WINDOW_SHOWN);
+        TiledFramebuffer fb;
+        fb.resize(width, height);
+        std::vector<uint32_t> target(static_cast<size_t>(width) * height);
+        Vec2 origin(width * 0.5f, height * 0.5f);
+        Camera identity;
+        identity.screenSize = Vec2(static_cast<float>(width), static_cast<float>(height));
+        identity.center = origin;
 
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1,
-        SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        for (int numRays : rayCounts) {
+            std::vector<RayHit> hits = makeBenchmarkRays(width, height, numRays);
+            Light light{ origin, identity.screenSize.length() * 0.5f, 0.0f };
+            LightFrame frame{ &light, nullptr, hits.data(), numRays, origin, light.radius };
 
+            double cpu[2];
+            for (int aa = 0; aa < 2; ++aa) {
+                antialiasRays = aa != 0;
+                Uint64 start = SDL_GetPerformanceCounter();
+                for (int f = 0; f < frames; ++f) {
+                    FrameArena::beginFrame();
+                    renderFrame(pool, fb, identity, &frame, 1, false);
+                    copyToLinear(pool, fb, target.data(), width * 4);
+                }
+                cpu[aa] = millisecondsSince(start) / frames;
+            }
+
+            if (renderer) {
+                double sdl = benchSdlLines(renderer, hits, origin, frames);
+                SDL_Log("%dx%d, %d rays: SDL lines (%s) %.2f ms, integer lines %.2f ms, anti-aliased %.2f ms",
+                    width, height, numRays, info.name, sdl, cpu[0], cpu[1]);
+            }
+            else {
+                SDL_Log("%dx%d, %d rays: integer lines %.2f ms, anti-aliased %.2f ms (no renderer: %s)",
+                    width, height, numRays, cpu[0], cpu[1], SDL_GetError());
+            }
+        }
+
+        if (renderer) SDL_DestroyRenderer(renderer);
+        if (surface) SDL_FreeSurface(surface);
+        if (window) SDL_DestroyWindow(window);
+    }
+    antialiasRays = antialiased;
+    SDL_Quit();
+    return 0;
+}
+
+const SDL_Color sdlRayHitColor = { 255, 255, 0, 100 };
+const SDL_Color sdlRayMissColor = { 255, 255, 0, 50 };
+const SDL_Color sdlOccluderColor = { 0, 120, 200, 255 };
+const SDL_Color sdlMarkerColor = { 255, 255, 0, 255 };
+
+// Rays and overlay for --sdl-lines, collected for one batched submit.
+void batchFrame(SdlBatch& batch, const LightFrame* frames, int count, const OverlayFrame& overlay) {
+    batch.clear();
+    for (int l = 0; l < count; ++l) {
+        const LightFrame& frame = frames[l];
+        for (int i = 0; i < frame.numRays; ++i) {
+            const RayHit& hit = frame.hits[i];
+            batch.addLine(frame.screenPos, hit.screenEnd, hit.hit ? sdlRayHitColor : sdlRayMissColor);
+        }
+    }
+    for (int i = 0; i < overlay.occluderCount; ++i) {
+        const CircleShape& circle = overlay.occluders[i];
+        if (circle.radius < 1.0f) batch.addPoint(circle.center, sdlOccluderColor);
+        else batch.addCircle(circle.center, circle.radius, sdlOccluderColor);
+    }
+    for (int i = 0; i < overlay.markerCount; ++i) {
+        batch.addCircle(overlay.markers[i].center, overlay.markers[i].radius, sdlMarkerColor);
+    }
+}
+
+// The same frame drawn one SDL call per ray, circle segment and point, as
+// --sdl-lines did before batching; the baseline for --bench-sdl-draw.
+// Returns the number of draw calls.
+int drawFrameImmediate(SDL_Renderer* renderer, const LightFrame* frames, int count, const OverlayFrame& overlay) {
+    int calls = 0;
+    for (int l = 0; l < count; ++l) {
+        const LightFrame& frame = frames[l];
+        for (int i = 0; i < frame.numRays; ++i, ++calls) {
+            const RayHit& hit = frame.hits[i];
+            SDL_SetRenderDrawColor(renderer, 255, 255, 0, hit.hit ? 100 : 50);
+            SDL_RenderDrawLine(renderer, static_cast<int>(frame.screenPos.x), static_cast<int>(frame.screenPos.y),
+                static_cast<int>(hit.screenEnd.x), static_cast<int>(hit.screenEnd.y));
+        }
+    }
+
+    auto drawCircle = [&](const CircleShape& circle) {
+        const int segments = SdlBatch::CircleSegments;
+        for (int i = 0; i < segments; ++i, ++calls) {
+            float angle1 = 2 * M_PI * i / segments;
+            float angle2 = 2 * M_PI * (i + 1) / segments;
+            SDL_RenderDrawLine(renderer,
+                static_cast<int>(circle.center.x + circle.radius * std::cos(angle1)),
+                static_cast<int>(circle.center.y + circle.radius * std::sin(angle1)),
+                static_cast<int>(circle.center.x + circle.radius * std::cos(angle2)),
+                static_cast<int>(circle.center.y + circle.radius * std::sin(angle2)));
+        }
+    };
+    SDL_SetRenderDrawColor(renderer, 0, 120, 200, 255);
+    for (int i = 0; i < overlay.occluderCount; ++i) {
+        const CircleShape& circle = overlay.occluders[i];
+        if (circle.radius >= 1.0f) {
+            drawCircle(circle);
+            continue;
+        }
+        SDL_RenderDrawPoint(renderer, static_cast<int>(circle.center.x), static_cast<int>(circle.center.y));
+        ++calls;
+    }
+    SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+    for (int i = 0; i < overlay.markerCount; ++i) drawCircle(overlay.markers[i]);
+    return calls;
+}
+
+// Compares the --sdl-lines frame drawn one call per primitive with the
+// batched submit, at 1280x720 with 10k rays, 5k circle outlines and 5k
+// points, on a hidden window without vsync. Times include the present.
+int runSdlDrawBenchmark() {
+    const int width = 1280;
+    const int height = 720;
+    const int frames = 20;
+    SDL_Init(SDL_INIT_VIDEO);
+    SDL_Window* window = SDL_CreateWindow("draw benchmark", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        width, height, SDL_WINDOW_HIDDEN);
+    SDL_Renderer* renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED) : nullptr;
+    if (!renderer) {
+        SDL_Log("draw benchmark: no renderer: %s", SDL_GetError());
+        SDL_Quit();
+        return 1;
+    }
     SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
 
-    bool running = true;
+    std::vector<RayHit> hits = makeBenchmarkRays(width, height, 10000);
+    Vec2 origin(width * 0.5f, height * 0.5f);
+    Light light{ origin, origin.length(), 0.0f };
+    LightFrame frame{ &light, nullptr, hits.data(), static_cast<int>(hits.size()), origin, light.radius };
+    std::vector<CircleShape> shapes;
+    for (int i = 0; i < 10000; ++i) {
+        Vec2 center(static_cast<float>(std::rand() % width), static_cast<float>(std::rand() % height));
+        shapes.push_back(CircleShape{ center, i % 2 ? 2.0f + std::rand() % 28 : 0.5f });
+    }
+    CircleShape marker{ origin, 20.0f };
+    OverlayFrame overlay{ shapes.data(), static_cast<int>(shapes.size()), &marker, 1, 1.0f };
 
-    while (running) {
-        SDL_Event event;
+    auto time = [&](const char* name, auto draw) {
+        int calls = 0;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int f = 0; f < frames; ++f) {
+            SDL_SetRenderDrawColor(renderer, 30, 30, 30, 255);
+            SDL_RenderClear(renderer);
+            calls = draw();
+            SDL_RenderPresent(renderer);
+        }
+        SDL_Log("%s: %d draw calls, %.2f ms/frame", name, calls, millisecondsSince(start) / frames);
+    };
+    SdlBatch batch;
+    time("one call per primitive", [&] { return drawFrameImmediate(renderer, &frame, 1, overlay); });
+    time("batched", [&] {
+        batchFrame(batch, &frame, 1, overlay);
+        return batch.submit(renderer);
+    });
 
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) running = false;
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 0;
+}
+
+// Cost of getting a CPU-rendered frame into a streaming texture at 1080p
+// and 4K: lock, de-swizzle into the locked pixels and unlock, on a hidden
+// window.
+int runPresentBenchmark() {
+    ThreadPool pool;
+    const int sizes[][2] = { { 1920, 1080 }, { 3840, 2160 } };
+    const int frames = 50;
+    SDL_Init(SDL_INIT_VIDEO);
+    SDL_Window* window = SDL_CreateWindow("present benchmark", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        640, 480, SDL_WINDOW_HIDDEN);
+    SDL_Renderer* renderer = window ? SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED) : nullptr;
+    if (!renderer) {
+        SDL_Log("present benchmark: no renderer: %s", SDL_GetError());
+        SDL_Quit();
+        return 1;
+    }
+    SDL_RendererInfo info;
+    SDL_GetRendererInfo(renderer, &info);
+    Uint32 format = streamingFormat(renderer);
+    SDL_Log("present benchmark: renderer %s, %d threads", info.name, pool.size());
+
+    for (const auto& size : sizes) {
+        SDL_Texture* texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING, size[0], size[1]);
+        if (!texture) {
+            SDL_Log("%dx%d: no texture: %s", size[0], size[1], SDL_GetError());
+            continue;
+        }
+        TiledFramebuffer fb;
+        fb.resize(size[0], size[1]);
+        fb.clearRows(0, size[1], backgroundColor);
+        presentFramebuffer(pool, fb, texture);
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int f = 0; f < frames; ++f) presentFramebuffer(pool, fb, texture);
+        SDL_Log("%dx%d: %.2f ms per upload", size[0], size[1], millisecondsSince(start) / frames);
+        SDL_DestroyTexture(texture);
+    }
+
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 0;
+}
+
+// Milliseconds per frame to draw every shape in shapes over a cleared
+// framebuffer, in parallel bands as renderFrame() does.
+template <typename Shape, typename Draw>
+double benchShapeSet(ThreadPool& pool, TiledFramebuffer& fb, const std::vector<Shape>& shapes, int frames, Draw draw) {
+    const int bandHeight = bandHeightFor(pool, fb);
+    int bands = (fb.getHeight() + bandHeight - 1) / bandHeight;
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int f = 0; f < frames; ++f) {
+        pool.parallelFor(bands, [&](int band) {
+            int y0 = band * bandHeight;
+            int y1 = std::min(y0 + bandHeight, fb.getHeight());
+            fb.clearRows(y0, y1, backgroundColor);
+            for (const Shape& shape : shapes) draw(y0, y1, shape);
+        });
+    }
+    return millisecondsSince(start) / frames;
+}
+
+// Draws 100k randomly placed shapes of 1 to 8 pixels radius at 1080p, the
+// scale of a large scene zoomed out.
+int runShapeBenchmark() {
+    ThreadPool pool;
+    const int width = 1920;
+    const int height = 1080;
+    const int count = 100000;
+    const int frames = 10;
+    TiledFramebuffer fb;
+    fb.resize(width, height);
+
+    std::vector<CircleShape> circles;
+    std::vector<CapsuleShape> capsules;
+    std::vector<PolygonShape> hexagons;
+    for (int i = 0; i < count; ++i) {
+        Vec2 center(static_cast<float>(std::rand() % width), static_cast<float>(std::rand() % height));
+        float radius = 1.0f + (std::rand() % 700) / 100.0f;
+        float angle = (std::rand() % 628) / 100.0f;
+        Vec2 dir(std::cos(angle), std::sin(angle));
+        circles.push_back(CircleShape{ center, radius });
+        capsules.push_back(CapsuleShape{ center - dir * radius, center + dir * radius, radius * 0.4f });
+        Vec2 points[6];
+        for (int k = 0; k < 6; ++k) {
+            float a = angle + k * static_cast<float>(M_PI) / 3;
+            points[k] = center + Vec2(std::cos(a), std::sin(a)) * radius;
+        }
+        hexagons.push_back(PolygonShape(points, 6));
+    }
 
-            if (event.type == SDL_MOUSEBUTTONDOWN) {
-                Vec2 mouse(event.button.x, event.button.y);
-                if ((mouse - lightPos).length() < 20) {
-                    draggingLight = true;
+    SDL_Log("shape benchmark: %d shapes at %dx%d, %d threads", count, width, height, pool.size());
+    SDL_Log("filled circles:   %.2f ms", benchShapeSet(pool, fb, circles, frames, [&](int y0, int y1, const CircleShape& c) {
+        fillShape(fb, y0, y1, c, occluderColor, 255);
+    }));
+    SDL_Log("circle outlines:  %.2f ms", benchShapeSet(pool, fb, circles, frames, [&](int y0, int y1, const CircleShape& c) {
+        strokeShape(fb, y0, y1, c, 1.0f, occluderColor, 255);
+    }));
+    SDL_Log("filled capsules:  %.2f ms", benchShapeSet(pool, fb, capsules, frames, [&](int y0, int y1, const CapsuleShape& c) {
+        fillShape(fb, y0, y1, c, occluderColor, 160);
+    }));
+    SDL_Log("filled hexagons:  %.2f ms", benchShapeSet(pool, fb, hexagons, frames, [&](int y0, int y1, const PolygonShape& p) {
+        fillShape(fb, y0, y1, p, occluderColor, 160);
+    }));
+    return 0;
+}
+
+// Light-length rays from random points on scenes from dense to very sparse,
+// traced through the BVH alone and with the occupancy map in front of it,
+// with and without LOD. The two must agree.
+int runOccupancyBenchmark() {
+    const int rays = 1 << 19;
+    const LodSettings lodOn{ 1.0f, 1.0f };
+    struct Setup { int circles; float width, height; };
+    const Setup setups[] = { { 200, 800, 600 }, { 2000, 800, 600 }, { 2000, 8000, 6000 }, { 20000, 25000, 19000 }, { 20000, 80000, 60000 } };
+    bool matched = true;
+    for (const Setup& setup : setups) {
+        Scene sparse = Scene::makeRandom(setup.circles, 1, setup.width, setup.height);
+        std::mt19937 rng(3);
+        std::uniform_real_distribution<float> xs(0.0f, setup.width);
+        std::uniform_real_distribution<float> ys(0.0f, setup.height);
+        std::uniform_real_distribution<float> angles(0.0f, 2 * static_cast<float>(M_PI));
+        std::vector<Vec2> origins(rays), dirs(rays);
+        for (int i = 0; i < rays; ++i) {
+            float angle = angles(rng);
+            origins[i] = Vec2(xs(rng), ys(rng));
+            dirs[i] = Vec2(std::cos(angle), std::sin(angle));
+        }
+
+        double bvhMs[2], mapMs[2];
+        int misses = 0;
+        for (int withLod = 0; withLod < 2; ++withLod) {
+            const LodSettings* settings = withLod ? &lodOn : nullptr;
+            std::vector<float> expected(rays);
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int i = 0; i < rays; ++i) {
+                float t;
+                expected[i] = sparse.wideBvh.intersect(origins[i], dirs[i], 250.0f, t, settings) ? t : -1.0f;
+            }
+            bvhMs[withLod] = millisecondsSince(start);
+            start = SDL_GetPerformanceCounter();
+            int mismatches = 0;
+            for (int i = 0; i < rays; ++i) {
+                float t;
+                float got = sparse.intersect(origins[i], dirs[i], 250.0f, t, settings) ? t : -1.0f;
+                mismatches += got != expected[i];
+            }
+            mapMs[withLod] = millisecondsSince(start);
+            if (mismatches) matched = false;
+            if (withLod) misses = static_cast<int>(std::count(expected.begin(), expected.end(), -1.0f));
+        }
+        double mrays = rays / 1000.0;
+        SDL_Log("%5d circles in %.0fx%.0f, %2.0f%% of the map occupied, %3.0f%% of rays miss: BVH %.1f / %.1f Mrays/s, with map %.1f / %.1f Mrays/s (without / with LOD)%s",
+            setup.circles, setup.width, setup.height, sparse.occupancy.occupiedFraction() * 100.0f, 100.0 * misses / rays,
+            mrays / bvhMs[0], mrays / bvhMs[1], mrays / mapMs[0], mrays / mapMs[1],
+            sparse.occupancy.isActive() ? "" : ", map off");
+    }
+    SDL_Log(matched ? "occupancy map: results match the BVH" : "occupancy map: results differ from the BVH");
+    return matched ? 0 : 1;
+}
+
+// Builds the BVH of random scenes of 100k to 10M circles, at the density
+// --random-scene uses, with each builder on one thread and on the pool,
+// and reports the build times, the tree's expected traversal cost and how
+// fast random rays are traced through it.
+int runBvhBuildBenchmark() {
+    ThreadPool pool;
+    const int rays = 1 << 18;
+    const int sizes[] = { 100000, 1000000, 10000000 };
+    struct Builder { BvhBuilder builder; const char* name; };
+    const Builder builders[] = { { BvhBuilder::BinnedSah, "binned SAH" }, { BvhBuilder::Median, "median    " }, { BvhBuilder::Lbvh, "LBVH      " } };
+    SDL_Log("BVH build benchmark: %d threads", pool.size());
+    for (int size : sizes) {
+        float scale = std::sqrt(size / 2000.0f);
+        float width = 800 * scale, height = 600 * scale;
+        std::mt19937 rng(13);
+        std::uniform_real_distribution<float> xs(0.0f, width);
+        std::uniform_real_distribution<float> ys(0.0f, height);
+        std::uniform_real_distribution<float> radii(2.0f, 12.0f);
+        std::uniform_real_distribution<float> angles(0.0f, 2 * static_cast<float>(M_PI));
+        std::vector<Circle> circles(size);
+        for (Circle& circle : circles) circle = Circle{ Vec2(xs(rng), ys(rng)), radii(rng) };
+        std::vector<Vec2> origins(rays), dirs(rays);
+        for (int i = 0; i < rays; ++i) {
+            float angle = angles(rng);
+            origins[i] = Vec2(xs(rng), ys(rng));
+            dirs[i] = Vec2(std::cos(angle), std::sin(angle));
+        }
+
+        for (const Builder& builder : builders) {
+            Bvh bvh;
+            Uint64 start = SDL_GetPerformanceCounter();
+            bvh.build(circles, builder.builder);
+            double serialMs = millisecondsSince(start);
+            start = SDL_GetPerformanceCounter();
+            bvh.build(circles, builder.builder, &pool);
+            double parallelMs = millisecondsSince(start);
+            WideBvh wide;
+            wide.build(bvh);
+
+            start = SDL_GetPerformanceCounter();
+            int hits = 0;
+            for (int i = 0; i < rays; ++i) {
+                float t;
+                hits += wide.intersect(origins[i], dirs[i], 250.0f, t);
+            }
+            double traceMs = millisecondsSince(start);
+            SDL_Log("%8d circles, %s: built in %7.1f ms on one thread, %7.1f ms on the pool; %8d nodes, expected cost %5.1f, %4.1f Mrays/s (%d hits)",
+                size, builder.name, serialMs, parallelMs, static_cast<int>(bvh.getNodes().size()), bvh.expectedCost(),
+                rays / 1000.0 / traceMs, hits);
+        }
+    }
+    return 0;
+}
+
+// Random rays over the demo scene and random scenes from dense to very
+// sparse, traced through the binary and the four-wide BVH, each alone and
+// behind the occupancy grid, with and without LOD. Without LOD all four
+// must agree. The grid is only switched on below OccupancyMap::MaxOccupied,
+// so the last setups are sparse enough for it; elsewhere its columns just
+// repeat the BVH's. Last, each builder's tree over a deep clustered scene
+// is checked against Bvh::MaxDepth and traced the same way.
+int runWideBvhBenchmark() {
+    const int rays = 1 << 19;
+    const LodSettings lodOn{ 1.0f, 1.0f };
+    struct Setup { int circles; float width, height, reach; };
+    const Setup setups[] = { { 0, 800, 600, 1000 }, { 200, 800, 600, 250 }, { 2000, 800, 600, 250 }, { 2000, 8000, 6000, 2000 },
+        { 20000, 25000, 19000, 250 }, { 20000, 25000, 19000, 5000 }, { 200000, 80000, 60000, 250 }, { 200000, 80000, 60000, 5000 },
+        { 2000, 25000, 19000, 250 }, { 2000, 25000, 19000, 5000 }, { 20000, 80000, 60000, 250 }, { 20000, 80000, 60000, 5000 } };
+    bool matched = true;
+    for (const Setup& setup : setups) {
+        Scene corpus = setup.circles ? Scene::makeRandom(setup.circles, 1, setup.width, setup.height) : Scene::makeDefault();
+        const WideBvh& wide = corpus.wideBvh;
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<float> xs(0.0f, setup.width);
+        std::uniform_real_distribution<float> ys(0.0f, setup.height);
+        std::uniform_real_distribution<float> angles(0.0f, 2 * static_cast<float>(M_PI));
+        std::vector<Vec2> origins(rays), dirs(rays);
+        for (int i = 0; i < rays; ++i) {
+            float angle = angles(rng);
+            origins[i] = Vec2(xs(rng), ys(rng));
+            dirs[i] = Vec2(std::cos(angle), std::sin(angle));
+        }
+
+        // Binary, wide, grid + binary, grid + wide; without and with LOD.
+        double ms[4][2];
+        for (int withLod = 0; withLod < 2; ++withLod) {
+            const LodSettings* settings = withLod ? &lodOn : nullptr;
+            std::vector<float> expected(rays);
+            for (int variant = 0; variant < 4; ++variant) {
+                bool grid = variant >= 2;
+                bool wideTree = variant % 2 == 1;
+                int mismatches = 0;
+                Uint64 start = SDL_GetPerformanceCounter();
+                for (int i = 0; i < rays; ++i) {
+                    float t;
+                    bool hit = (!grid || corpus.occupancy.mayHit(origins[i], dirs[i], setup.reach, settings))
+                        && (wideTree ? wide.intersect(origins[i], dirs[i], setup.reach, t, settings)
+                            : corpus.bvh.intersect(origins[i], dirs[i], setup.reach, t, settings));
+                    float got = hit ? t : -1.0f;
+                    if (variant == 0) expected[i] = got;
+                    else mismatches += got != expected[i];
+                }
+                ms[variant][withLod] = millisecondsSince(start);
+                if (!withLod && mismatches) matched = false;
+            }
+        }
+        double mrays = rays / 1000.0;
+        SDL_Log("%6d circles in %5.0fx%-5.0f rays %4.0f: binary %5.1f / %5.1f, wide %5.1f / %5.1f, grid + binary %5.1f / %5.1f, grid + wide %5.1f / %5.1f Mrays/s%s",
+            static_cast<int>(corpus.circles.size()), setup.width, setup.height, setup.reach,
+            mrays / ms[0][0], mrays / ms[0][1], mrays / ms[1][0], mrays / ms[1][1],
+            mrays / ms[2][0], mrays / ms[2][1], mrays / ms[3][0], mrays / ms[3][1],
+            corpus.occupancy.isActive() ? "" : " (grid off)");
+    }
+    SDL_Log("(without / with LOD)");
+
+    // A million circles in tight power-law clusters build the deepest trees
+    // the builders make; the traversal stacks must hold them.
+    struct Builder { BvhBuilder builder; const char* name; };
+    const Builder builders[] = { { BvhBuilder::Lbvh, "LBVH      " }, { BvhBuilder::BinnedSah, "binned SAH" }, { BvhBuilder::Median, "median    " } };
+    const float deepWidth = 25000, deepHeight = 19000;
+    Scene deep = Scene::scatterClustered(1000000, 1, deepWidth, deepHeight);
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> xs(0.0f, deepWidth);
+    std::uniform_real_distribution<float> ys(0.0f, deepHeight);
+    std::uniform_real_distribution<float> angles(0.0f, 2 * static_cast<float>(M_PI));
+    std::vector<Vec2> origins(rays), dirs(rays);
+    for (int i = 0; i < rays; ++i) {
+        float angle = angles(rng);
+        origins[i] = Vec2(xs(rng), ys(rng));
+        dirs[i] = Vec2(std::cos(angle), std::sin(angle));
+    }
+    bool fits = true;
+    for (const Builder& builder : builders) {
+        deep.rebuild(builder.builder);
+        int binaryDepth = deep.bvh.depth();
+        int wideDepth = deep.wideBvh.depth();
+        if (binaryDepth > Bvh::MaxDepth || wideDepth > Bvh::MaxDepth) fits = false;
+        int mismatches = 0;
+        for (int withLod = 0; withLod < 2; ++withLod) {
+            const LodSettings* settings = withLod ? &lodOn : nullptr;
+            for (int i = 0; i < rays; ++i) {
+                float t, u;
+                bool binaryHit = deep.bvh.intersect(origins[i], dirs[i], 5000.0f, t, settings);
+                bool wideHit = deep.wideBvh.intersect(origins[i], dirs[i], 5000.0f, u, settings);
+                if (!withLod) mismatches += (binaryHit ? t : -1.0f) != (wideHit ? u : -1.0f);
+            }
+        }
+        if (mismatches) matched = false;
+        SDL_Log("1000000 clustered circles, %s: binary depth %2d, wide depth %2d (at most %d); %d mismatches",
+            builder.name, binaryDepth, wideDepth, Bvh::MaxDepth, mismatches);
+    }
+
+    SDL_Log(matched ? "wide BVH: results match the binary BVH" : "wide BVH: results differ from the binary BVH");
+    if (!fits) SDL_Log("BVH: a tree is deeper than the traversal stacks hold");
+    return matched && fits ? 0 : 1;
+}
+
+// Random scenes at --random-scene density, from what fits in cache to far
+// beyond it, traced through the four-wide BVH with full and with quantized
+// child bounds. Quantized bounds only ever grow, so without LOD the hits
+// must be the same.
+int runCompressedBvhBenchmark() {
+    const int rays = 1 << 19;
+    const LodSettings lodOn{ 1.0f, 1.0f };
+    const int sizes[] = { 20000, 200000, 2000000 };
+    const float reaches[] = { 250.0f, 5000.0f };
+    bool matched = true;
+    for (int size : sizes) {
+        float scale = std::sqrt(size / 2000.0f);
+        float width = 800 * scale, height = 600 * scale;
+        Scene corpus = Scene::makeRandom(size, 1, width, height);
+        QuantizedWideBvh quantized;
+        quantized.build(corpus.bvh);
+        size_t nodeCount = corpus.wideBvh.getNodes().size();
+        SDL_Log("%7d circles: nodes and proxies %6.1f MB full, %6.1f MB quantized (%d / %d bytes a node)", size,
+            corpus.wideBvh.nodeBytes() / 1048576.0, quantized.nodeBytes() / 1048576.0,
+            static_cast<int>(corpus.wideBvh.nodeBytes() / nodeCount), static_cast<int>(quantized.nodeBytes() / nodeCount));
+
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<float> xs(0.0f, width);
+        std::uniform_real_distribution<float> ys(0.0f, height);
+        std::uniform_real_distribution<float> angles(0.0f, 2 * static_cast<float>(M_PI));
+        std::vector<Vec2> origins(rays), dirs(rays);
+        for (int i = 0; i < rays; ++i) {
+            float angle = angles(rng);
+            origins[i] = Vec2(xs(rng), ys(rng));
+            dirs[i] = Vec2(std::cos(angle), std::sin(angle));
+        }
+        for (float reach : reaches) {
+            // Full, quantized; without and with LOD.
+            double ms[2][2];
+            for (int withLod = 0; withLod < 2; ++withLod) {
+                const LodSettings* settings = withLod ? &lodOn : nullptr;
+                std::vector<float> expected(rays);
+                for (int variant = 0; variant < 2; ++variant) {
+                    int mismatches = 0;
+                    Uint64 start = SDL_GetPerformanceCounter();
+                    for (int i = 0; i < rays; ++i) {
+                        float t;
+                        bool hit = variant ? quantized.intersect(origins[i], dirs[i], reach, t, settings)
+                            : corpus.wideBvh.intersect(origins[i], dirs[i], reach, t, settings);
+                        float got = hit ? t : -1.0f;
+                        if (variant == 0) expected[i] = got;
+                        else mismatches += got != expected[i];
+                    }
+                    ms[variant][withLod] = millisecondsSince(start);
+                    if (!withLod && mismatches) matched = false;
                 }
             }
+            double mrays = rays / 1000.0;
+            SDL_Log("         rays %4.0f: full %5.1f / %5.1f, quantized %5.1f / %5.1f Mrays/s", reach,
+                mrays / ms[0][0], mrays / ms[0][1], mrays / ms[1][0], mrays / ms[1][1]);
+        }
+    }
+    SDL_Log("(without / with LOD)");
+    SDL_Log(matched ? "quantized BVH: results match the full BVH" : "quantized BVH: results differ from the full BVH");
+    return matched ? 0 : 1;
+}
+
+// Random scenes of 100k to 10M circles at --random-scene density, and a
+// clustered one whose trees are as deep as the builders make: builds their
+// accelerators on the pool, saves them to the accelerator cache in
+// directory and loads them back, and checks that the loaded trees are the
+// built ones and trace the same hits. The files are removed afterwards.
+int runAcceleratorCacheBenchmark(const char* directory) {
+    ThreadPool pool;
+    AcceleratorCache cache(directory);
+    const int rays = 1 << 18;
+    struct Setup { int size; bool clustered; };
+    const Setup setups[] = { { 100000, false }, { 1000000, false }, { 10000000, false }, { 200000, true } };
+    bool matched = true;
+    SDL_Log("accelerator cache benchmark: %d threads, files in %s", pool.size(), directory);
+    for (const Setup& setup : setups) {
+        int size = setup.size;
+        float scale = std::sqrt(size / 2000.0f);
+        float width = 800 * scale, height = 600 * scale;
+        Scene built = setup.clustered ? Scene::scatterClustered(size, 1, width, height) : Scene::scatterRandom(size, 1, width, height);
+        Scene loaded = setup.clustered ? Scene::scatterClustered(size, 1, width, height) : Scene::scatterRandom(size, 1, width, height);
+        std::string path = cache.pathFor(AcceleratorCache::key(built.circles, BvhBuilder::Lbvh));
+        std::remove(path.c_str());
 
-            if (event.type == SDL_MOUSEBUTTONUP) {
-                draggingLight = false;
+        Uint64 start = SDL_GetPerformanceCounter();
+        built.rebuild(BvhBuilder::Lbvh, &pool);
+        double buildMs = millisecondsSince(start);
+        start = SDL_GetPerformanceCounter();
+        bool saved = cache.save(built.circles, BvhBuilder::Lbvh, built.bvh, built.wideBvh, built.occupancy);
+        double saveMs = millisecondsSince(start);
+        start = SDL_GetPerformanceCounter();
+        AcceleratorCache::Result result = loaded.rebuild(BvhBuilder::Lbvh, &pool, &cache);
+        double loadMs = millisecondsSince(start);
+        if (!saved || result != AcceleratorCache::Result::Loaded) {
+            SDL_Log("%8d circles: could not save or load %s", size, path.c_str());
+            matched = false;
+            continue;
+        }
+
+        const std::vector<BvhNode>& nodes = built.bvh.getNodes();
+        bool same = loaded.bvh.getNodes().size() == nodes.size()
+            && std::memcmp(loaded.bvh.getNodes().data(), nodes.data(), nodes.size() * sizeof(BvhNode)) == 0
+            && loaded.wideBvh.getNodes().size() == built.wideBvh.getNodes().size()
+            && std::memcmp(loaded.wideBvh.getNodes().data(), built.wideBvh.getNodes().data(),
+                built.wideBvh.getNodes().size() * sizeof(WideBvhNode)) == 0;
+        std::mt19937 rng(5);
+        std::uniform_real_distribution<float> xs(0.0f, width);
+        std::uniform_real_distribution<float> ys(0.0f, height);
+        std::uniform_real_distribution<float> angles(0.0f, 2 * static_cast<float>(M_PI));
+        for (int i = 0; i < rays && same; ++i) {
+            float angle = angles(rng);
+            Vec2 origin(xs(rng), ys(rng)), dir(std::cos(angle), std::sin(angle));
+            float a = -1.0f, b = -1.0f;
+            bool hitA = built.intersect(origin, dir, 250.0f, a);
+            bool hitB = loaded.intersect(origin, dir, 250.0f, b);
+            same = hitA == hitB && (!hitA || a == b);
+        }
+        if (!same) matched = false;
+        MappedFile file = MappedFile::open(path.c_str());
+        SDL_Log("%8d circles%s: built in %7.1f ms, saved in %6.1f ms, loaded in %6.1f ms; %6.1f MB file%s",
+            size, setup.clustered ? " (clustered)" : "", buildMs, saveMs, loadMs, file.getSize() / 1048576.0,
+            same ? "" : ", differs from the built one");
+        file.close();
+        std::remove(path.c_str());
+    }
+    SDL_Log(matched ? "accelerator cache: loaded accelerators match the built ones"
+                    : "accelerator cache: loaded accelerators differ from the built ones");
+    return matched ? 0 : 1;
+}
+
+// Batches of random closest-hit and visibility queries, as a query client
+// would send them, answered in the order they came and sorted by RayOrder.
+// The answers must be the same.
+int runRaySortBenchmark() {
+    ThreadPool pool;
+    const uint32_t count = 1 << 20;
+    const int repeats = 3;
+    struct Setup { int circles; float width, height, reach; };
+    const Setup setups[] = { { 20000, 25000, 19000, 2000 }, { 60000, 45000, 34000, 2000 }, { 200000, 80000, 60000, 2000 }, { 200000, 80000, 60000, 250 } };
+    bool matched = true;
+    SDL_Log("ray sort benchmark: %u queries per batch, %d threads", count, pool.size());
+    for (const Setup& setup : setups) {
+        Scene random = Scene::makeRandom(setup.circles, 1, setup.width, setup.height);
+        std::mt19937 rng(11);
+        std::uniform_real_distribution<float> xs(0.0f, setup.width);
+        std::uniform_real_distribution<float> ys(0.0f, setup.height);
+        std::uniform_real_distribution<float> offsets(-setup.reach, setup.reach);
+        std::uniform_real_distribution<float> angles(0.0f, 2 * static_cast<float>(M_PI));
+        RayQuery::Scratch scratch;
+        for (uint32_t kind : { RayQuery::ClosestHit, RayQuery::Visible }) {
+            std::vector<float> records;
+            for (uint32_t i = 0; i < count; ++i) {
+                Vec2 from(xs(rng), ys(rng));
+                records.push_back(from.x);
+                records.push_back(from.y);
+                if (kind == RayQuery::ClosestHit) {
+                    float angle = angles(rng);
+                    records.push_back(std::cos(angle));
+                    records.push_back(std::sin(angle));
+                    records.push_back(setup.reach);
+                }
+                else {
+                    records.push_back(from.x + offsets(rng));
+                    records.push_back(from.y + offsets(rng));
+                }
             }
+            const uint8_t* batch = reinterpret_cast<const uint8_t*>(records.data());
+            std::vector<uint8_t> expected(RayQuery::resultSize(kind, count)), got(expected.size());
 
-            if (event.type == SDL_MOUSEMOTION && draggingLight) {
-                lightPos.x = event.motion.x;
-                lightPos.y = event.motion.y;
+            double inOrderMs = 1e30, sortedMs = 1e30;
+            for (int r = 0; r < repeats; ++r) {
+                Uint64 start = SDL_GetPerformanceCounter();
+                RayQuery::answer(pool, random, kind, count, batch, expected.data());
+                inOrderMs = std::min(inOrderMs, millisecondsSince(start));
+                start = SDL_GetPerformanceCounter();
+                RayQuery::answer(pool, random, kind, count, batch, got.data(), &scratch);
+                sortedMs = std::min(sortedMs, millisecondsSince(start));
             }
+            Uint64 start = SDL_GetPerformanceCounter();
+            scratch.order.sort(count, [&](uint32_t i, Vec2& origin, Vec2& dir) { RayQuery::fetchRay(kind, batch, i, origin, dir); });
+            double sortMs = millisecondsSince(start);
+            if (got != expected) matched = false;
+
+            double mrays = count / 1000.0;
+            SDL_Log("%6d circles in %.0fx%.0f, %s up to %.0f long: in order %.1f Mrays/s, sorted %.1f Mrays/s (sorting %.1f ms)%s",
+                setup.circles, setup.width, setup.height, kind == RayQuery::ClosestHit ? "rays    " : "segments", setup.reach,
+                mrays / inOrderMs, mrays / sortedMs, sortMs,
+                random.bvh.getPrimitives().size() >= RayQuery::MinSortedCircles ? "" : ", sorting off for this scene");
         }
+    }
+    SDL_Log(matched ? "ray sort: results match" : "ray sort: results differ");
+    return matched ? 0 : 1;
+}
 
-        SDL_SetRenderDrawColor(renderer, 30, 30, 30, 255);
-        SDL_RenderClear(renderer);
+#ifdef SRT_PROFILE
+const int allocationWarmupFrames = 60;
+
+bool reportFrameAllocations(int frameIndex) {
+    FrameAllocations allocations = AllocationTracker::endFrame();
+    if (frameIndex < allocationWarmupFrames || allocations.totalCount() == 0) return true;
 
-        SDL_SetRenderDrawColor(renderer, 0, 120, 200, 255);
-        drawCircle(renderer, sphereCenter, sphereRadius);
+    for (int i = 0; i < static_cast<int>(FrameStage::Count); ++i) {
+        if (allocations.count[i] == 0) continue;
+        SDL_Log("frame %d: %llu heap allocations (%llu bytes) in %s stage",
+            frameIndex, static_cast<unsigned long long>(allocations.count[i]),
+            static_cast<unsigned long long>(allocations.bytes[i]),
+            frameStageName(static_cast<FrameStage>(i)));
+    }
+    return false;
+}
+#endif
+
+// Where the first light is in frame n of a headless or render farm run.
+Vec2 sweptLightPosition(int frame) {
+    Vec2 sweep(300 * std::cos(frame * 0.05f), 200 * std::sin(frame * 0.07f));
+    return camera.screenToWorld(camera.screenSize * 0.5f + sweep);
+}
+
+// Runs the trace and draw stages without a window, sweeping the first light
+// across the view. In SRT_PROFILE builds any heap allocation after warm-up
+// is a failure, which makes this usable as a regression check from scripts.
+// Quality is fixed unless a frame budget was given explicitly.
+int runHeadless(int frames) {
+    bool clean = true;
+    ThreadPool pool;
+    QualityController quality(targetFrameMs > 0 ? targetFrameMs : 0.0, renderScale);
+    // Sized for the highest level up front so stepping between levels
+    // reuses the same storage.
+    TiledFramebuffer framebuffer;
+    framebuffer.resize(scaledSize(800), scaledSize(600));
+    std::vector<LightState> lightStates = makeLightStates(scene);
+    std::vector<CircleShape> occluders;
+    Uint64 start = SDL_GetPerformanceCounter();
+
+    for (int frame = 0; frame < frames; ++frame) {
+        Uint64 frameStart = SDL_GetPerformanceCounter();
+        FrameArena::beginFrame();
+        AllocationTracker::setStage(FrameStage::Trace);
+        FrameArena& arena = FrameArena::forThisThread();
+
+        int numRays = 360;
+        if (quality.enabled()) {
+            numRays = quality.getNumRays();
+            float scale = quality.getRenderScale();
+            int width = std::max(1, static_cast<int>(800 * scale + 0.5f));
+            int height = std::max(1, static_cast<int>(600 * scale + 0.5f));
+            if (width != framebuffer.getWidth() || height != framebuffer.getHeight()) framebuffer.resize(width, height);
+        }
+        Camera renderCamera = camera.resized(framebuffer.getWidth(), framebuffer.getHeight());
+        lod.pixelsPerUnit = renderCamera.zoom;
+
+        scene.lights[0].position = sweptLightPosition(frame);
+        LightFrame* lightFrames = arena.allocArray<LightFrame>(scene.lights.size());
+        int lightCount = traceFrame(pool, scene, lightStates, renderCamera, numRays, lightFrames);
+
+        AllocationTracker::setStage(FrameStage::Draw);
+        float markerRadius = 20.0f * renderCamera.zoom / camera.zoom;
+        OverlayFrame overlay = collectOverlay(scene, renderCamera, lightFrames, lightCount, markerRadius, 1.0f, occluders);
+        renderFrame(pool, framebuffer, renderCamera, lightFrames, lightCount, true, &overlay);
+
+        quality.addFrame(millisecondsSince(frameStart));
+#ifdef SRT_PROFILE
+        clean = reportFrameAllocations(frame) && clean;
+#endif
+    }
+
+    if (quality.enabled()) {
+        SDL_Log("headless: settled on %d rays at %.0f%% scale (%.2f ms average, %.2f ms target)",
+            quality.getNumRays(), quality.getRenderScale() * 100.0f, quality.getAverageMs(), quality.getTargetMs());
+    }
+    double seconds = static_cast<double>(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    SDL_Log("headless: %dx%d, %d frames, %.3f ms/frame", framebuffer.getWidth(), framebuffer.getHeight(), frames, seconds * 1000.0 / (frames > 0 ? frames : 1));
+#ifdef SRT_PROFILE
+    SDL_Log(clean ? "headless: no heap allocations after warm-up"
+                  : "headless: heap allocations after warm-up");
+#endif
+    return clean ? 0 : 1;
+}
+
+// Size in pixels of what frames are presented to: the renderer's output,
+// or the window surface when there is no renderer.
+void outputSize(SDL_Window* window, SDL_Renderer* renderer, int& width, int& height) {
+    if (renderer) {
+        SDL_GetRendererOutputSize(renderer, &width, &height);
+        return;
+    }
+    SDL_Surface* surface = SDL_GetWindowSurface(window);
+    if (surface) {
+        width = surface->w;
+        height = surface->h;
+    }
+    else {
+        SDL_GetWindowSize(window, &width, &height);
+    }
+}
+
+// Output pixels per window point; mouse events arrive in points.
+float outputScale(SDL_Window* window, SDL_Renderer* renderer) {
+    int windowWidth, windowHeight, outputWidth, outputHeight;
+    SDL_GetWindowSize(window, &windowWidth, &windowHeight);
+    outputSize(window, renderer, outputWidth, outputHeight);
+    return windowWidth > 0 ? static_cast<float>(outputWidth) / windowWidth : 1.0f;
+}
 
-        const int numRays = 360;
-        for (int i = 0; i < numRays; ++i) {
-            float angle = 2 * M_PI * i / numRays;
-            Vec2 dir(std::cos(angle), std::sin(angle));
+// Reallocates the framebuffer and streaming texture when the wanted size
+// differs from the current one, so resizing costs nothing on other frames.
+// Without a renderer there is only the framebuffer.
+void ensureRenderTarget(SDL_Renderer* renderer, Uint32 format, TiledFramebuffer& fb, SDL_Texture*& texture, int width, int height) {
+    if (fb.getWidth() != width || fb.getHeight() != height) {
+        fb.resize(width, height);
+        if (texture) SDL_DestroyTexture(texture);
+        texture = nullptr;
+    }
+    if (!texture && renderer) texture = SDL_CreateTexture(renderer, format, SDL_TEXTUREACCESS_STREAMING, width, height);
+}
 
-            float t;
-            if (intersect(lightPos, dir, t)) {
-                Vec2 hitPoint = lightPos + (dir * t);
-                SDL_SetRenderDrawColor(renderer, 255, 255, 0, 100);
-                SDL_RenderDrawLine(renderer,
-                    static_cast<int>(lightPos.x), static_cast<int>(lightPos.y),
-                    static_cast<int>(hitPoint.x), static_cast<int>(hitPoint.y)
-                );
+// Presents without a renderer through the window surface, which SDL backs
+// with the video driver's own framebuffer (an X11 shared-memory image, for
+// instance). When the sizes and pixel layout match, the framebuffer is
+// de-swizzled straight into it; otherwise, at a reduced render scale or on
+// a 16-bit or BGR visual, it goes through a staging surface and SDL's
+// scaling blit.
+void presentToSurface(ThreadPool& pool, const TiledFramebuffer& fb, SDL_Window* window, SDL_Surface*& staging) {
+    SDL_Surface* surface = SDL_GetWindowSurface(window);
+    if (!surface) return;
+    Uint32 format = surface->format->format;
+    if (fb.getWidth() == surface->w && fb.getHeight() == surface->h
+        && (format == SDL_PIXELFORMAT_ARGB8888 || format == SDL_PIXELFORMAT_RGB888)) {
+        if (SDL_MUSTLOCK(surface) && SDL_LockSurface(surface) != 0) return;
+        copyToLinear(pool, fb, surface->pixels, surface->pitch);
+        if (SDL_MUSTLOCK(surface)) SDL_UnlockSurface(surface);
+    }
+    else {
+        if (!staging || staging->w != fb.getWidth() || staging->h != fb.getHeight()) {
+            if (staging) SDL_FreeSurface(staging);
+            staging = SDL_CreateRGBSurfaceWithFormat(0, fb.getWidth(), fb.getHeight(), 32, SDL_PIXELFORMAT_ARGB8888);
+            if (!staging) return;
+        }
+        copyToLinear(pool, fb, staging->pixels, staging->pitch);
+        SDL_BlitScaled(staging, nullptr, surface, nullptr);
+    }
+    SDL_UpdateWindowSurface(window);
+}
+
+// The window events the scene reacts to, in output pixels.
+bool toInputEvent(const SDL_Event& event, float pixelsPerPoint, InputEvent& input) {
+    auto pixels = [&](int points) { return static_cast<int16_t>(points * pixelsPerPoint); };
+    if (event.type == SDL_MOUSEBUTTONDOWN || event.type == SDL_MOUSEBUTTONUP) {
+        input.type = event.type == SDL_MOUSEBUTTONDOWN ? InputEvent::MouseDown : InputEvent::MouseUp;
+        input.button = event.button.button;
+        input.x = pixels(event.button.x);
+        input.y = pixels(event.button.y);
+    }
+    else if (event.type == SDL_MOUSEMOTION) {
+        input.type = InputEvent::MouseMove;
+        input.buttons = static_cast<uint8_t>(event.motion.state);
+        input.x = pixels(event.motion.x);
+        input.y = pixels(event.motion.y);
+        input.dx = pixels(event.motion.xrel);
+        input.dy = pixels(event.motion.yrel);
+    }
+    else if (event.type == SDL_MOUSEWHEEL) {
+        int x, y;
+        SDL_GetMouseState(&x, &y);
+        input.type = InputEvent::Wheel;
+        input.x = pixels(x);
+        input.y = pixels(y);
+        input.value = event.wheel.y;
+    }
+    else if (event.type == SDL_KEYDOWN) {
+        input.type = InputEvent::Key;
+        input.value = event.key.keysym.sym;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Light dragging, panning, zooming and rotation. A light is picked when
+// pressed within pickRadius pixels of it.
+void applyInput(const InputEvent& input, float pickRadius) {
+    Vec2 mouse(input.x, input.y);
+    if (input.type == InputEvent::MouseDown && input.button == SDL_BUTTON_LEFT) {
+        for (size_t i = 0; i < scene.lights.size(); ++i) {
+            if ((mouse - camera.worldToScreen(scene.lights[i].position)).length() < pickRadius) {
+                draggedLight = static_cast<int>(i);
+                break;
+            }
+        }
+    }
+    else if (input.type == InputEvent::MouseUp && input.button == SDL_BUTTON_LEFT) {
+        draggedLight = -1;
+    }
+    else if (input.type == InputEvent::MouseMove) {
+        if (draggedLight >= 0) {
+            scene.lights[draggedLight].position = camera.screenToWorld(mouse);
+        }
+        else if (input.buttons & (SDL_BUTTON_RMASK | SDL_BUTTON_MMASK)) {
+            camera.pan(Vec2(input.dx, input.dy));
+        }
+    }
+    else if (input.type == InputEvent::Wheel) {
+        camera.zoomAt(mouse, std::pow(1.2f, static_cast<float>(input.value)));
+    }
+    else if (input.type == InputEvent::Key) {
+        if (input.value == SDLK_q) camera.rotateAt(camera.screenSize * 0.5f, -0.1f);
+        if (input.value == SDLK_e) camera.rotateAt(camera.screenSize * 0.5f, 0.1f);
+        if (input.value == SDLK_f && !scene.bvh.empty()) camera.frame(scene.bvh.getNodes()[0].bounds);
+    }
+}
+
+const int defaultStreamPort = 9753;
+
+// Splits "host:port" or "port"; the host is left alone when not given.
+void parseEndpoint(const char* text, std::string& host, int& port) {
+    const char* colon = std::strrchr(text, ':');
+    if (colon) host.assign(text, colon);
+    port = std::atoi(colon ? colon + 1 : text);
+    if (port <= 0) port = defaultStreamPort;
+}
+
+// Renders for one remote viewer at a time, at the viewer's window size
+// times the render scale, and streams the changed blocks of each frame.
+// Input from the viewer drives the scene as the local window would. Runs
+// until killed.
+int runFrameServer(const char* address, int port) {
+    FrameStreamServer server;
+    if (!server.listen(address, port)) {
+        SDL_Log("frame server: cannot listen on %s:%d", address, port);
+        return 1;
+    }
+    SDL_Log("frame server: listening on %s:%d", address, port);
+
+    ThreadPool pool;
+    TiledFramebuffer framebuffer;
+    std::vector<LightState> lightStates = makeLightStates(scene);
+    std::vector<CircleShape> occluders;
+    // There is no vsync to pace the loop, so frames are capped at 60 per
+    // second; frames with no changed blocks are only a header.
+    const double frameMs = 1000.0 / 60.0;
+    int frameIndex = 0;
+
+    for (;;) {
+        if (!server.connected()) {
+            if (server.waitForClient(1000)) SDL_Log("frame server: viewer connected");
+            continue;
+        }
+        Uint64 frameStart = SDL_GetPerformanceCounter();
+        FrameArena::beginFrame();
+        FrameArena& arena = FrameArena::forThisThread();
+
+        InputEvent input;
+        while (server.pollInput(input)) {
+            if (input.type == InputEvent::Resize) {
+                const int maxSize = FrameStreamServer::MaxSize;
+                if (input.x > 0 && input.y > 0) {
+                    camera.screenSize = Vec2(std::min<int>(input.x, maxSize), std::min<int>(input.y, maxSize));
+                }
             }
             else {
-                Vec2 end = lightPos + (dir * 1000.0f);
-                SDL_SetRenderDrawColor(renderer, 255, 255, 0, 50);
-                SDL_RenderDrawLine(renderer,
-                    static_cast<int>(lightPos.x), static_cast<int>(lightPos.y),
-                    static_cast<int>(end.x), static_cast<int>(end.y)
-                );
+                applyInput(input, 20.0f);
             }
         }
+        if (!server.connected()) {
+            SDL_Log("frame server: viewer disconnected");
+            continue;
+        }
+
+        int width = scaledSize(static_cast<int>(camera.screenSize.x));
+        int height = scaledSize(static_cast<int>(camera.screenSize.y));
+        if (width != framebuffer.getWidth() || height != framebuffer.getHeight()) framebuffer.resize(width, height);
+        Camera renderCamera = camera.resized(width, height);
+        lod.pixelsPerUnit = renderCamera.zoom;
+        LightFrame* lightFrames = arena.allocArray<LightFrame>(scene.lights.size());
+        int lightCount = traceFrame(pool, scene, lightStates, renderCamera, 360, lightFrames);
+        float markerRadius = 20.0f * renderCamera.zoom / camera.zoom;
+        OverlayFrame overlay = collectOverlay(scene, renderCamera, lightFrames, lightCount, markerRadius, 1.0f, occluders);
+        renderFrame(pool, framebuffer, renderCamera, lightFrames, lightCount, true, &overlay);
+
+        if (!server.sendFrame(pool, framebuffer)) {
+            SDL_Log("frame server: viewer disconnected");
+            continue;
+        }
+        if (++frameIndex % 300 == 0) {
+            SDL_Log("frame server: %dx%d, last frame %u changed blocks, %.1f KB",
+                width, height, server.getLastBlocks(), server.getLastBytes() / 1024.0);
+        }
+        double elapsed = millisecondsSince(frameStart);
+        if (elapsed < frameMs) SDL_Delay(static_cast<Uint32>(frameMs - elapsed));
+    }
+}
 
-        SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
-        drawCircle(renderer, lightPos, 20);
+// Shows the frames of a --stream-frames server in a window and sends the
+// window's input and size back to it.
+int runFrameViewer(const char* host, int port) {
+    FrameStreamClient client;
+    if (!client.connect(host, port)) {
+        SDL_Log("viewer: cannot connect to %s:%d", host, port);
+        return 1;
+    }
+    SDL_Init(SDL_INIT_VIDEO);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+    SDL_Window* window = SDL_CreateWindow("Interactive Raytracer (remote)",
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        800, 600, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+    if (!renderer) renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    if (!renderer) {
+        SDL_Log("viewer: no renderer: %s", SDL_GetError());
+        SDL_Quit();
+        return 1;
+    }
+    SDL_Texture* texture = nullptr;
+    int textureWidth = 0;
+    int textureHeight = 0;
+
+    float pixelsPerPoint = outputScale(window, renderer);
+    auto sendSize = [&] {
+        InputEvent resize;
+        int width, height;
+        outputSize(window, renderer, width, height);
+        resize.type = InputEvent::Resize;
+        resize.x = static_cast<int16_t>(width);
+        resize.y = static_cast<int16_t>(height);
+        client.sendInput(resize);
+    };
+    sendSize();
 
+    bool running = true;
+    while (running && client.connected()) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) running = false;
+            if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                pixelsPerPoint = outputScale(window, renderer);
+                sendSize();
+            }
+            InputEvent input;
+            if (toInputEvent(event, pixelsPerPoint, input)) client.sendInput(input);
+        }
+
+        if (client.receiveFrame(10) <= 0) continue;
+        if (!texture || textureWidth != client.getWidth() || textureHeight != client.getHeight()) {
+            if (texture) SDL_DestroyTexture(texture);
+            textureWidth = client.getWidth();
+            textureHeight = client.getHeight();
+            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, textureWidth, textureHeight);
+        }
+        SDL_UpdateTexture(texture, nullptr, client.getPixels(), textureWidth * 4);
+        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
         SDL_RenderPresent(renderer);
     }
+    if (running) SDL_Log("viewer: connection closed");
 
+    if (texture) SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
 }
+
+const int defaultQueryPort = 9754;
+
+// Keeps the scene and its BVH loaded and answers batched ray queries from
+// local clients (see RayService.h) until killed.
+int runQueryServer(const char* address, int port) {
+    ThreadPool pool;
+    RayQueryServer server(scene, pool);
+    if (!server.listen(address, port)) {
+        SDL_Log("query server: cannot listen on %s:%d", address, port);
+        return 1;
+    }
+    SDL_Log("query server: %d circles, %d threads, listening on %s:%d",
+        static_cast<int>(scene.circles.size()), pool.size(), address, port);
+    int connections = 0;
+    for (;;) {
+        server.poll(1000);
+        if (server.connectionCount() != connections) {
+            connections = server.connectionCount();
+            SDL_Log("query server: %d clients, %llu queries answered", connections,
+                static_cast<unsigned long long>(server.queriesAnswered()));
+        }
+    }
+}
+
+// count random queries of kind's layout over the scene's bounds, the same
+// ones every run.
+std::vector<float> randomQueries(uint32_t kind, size_t count) {
+    Aabb bounds = scene.bvh.empty() ? Aabb(Vec2(0, 0), Vec2(800, 600)) : scene.bvh.getNodes()[0].bounds;
+    float reach = bounds.extent().length();
+    std::mt19937 rng(7 + kind);
+    std::uniform_real_distribution<float> xs(bounds.min.x, bounds.max.x);
+    std::uniform_real_distribution<float> ys(bounds.min.y, bounds.max.y);
+    std::uniform_real_distribution<float> angles(0.0f, 2 * static_cast<float>(M_PI));
+
+    size_t floats = RayQuery::recordSize(kind) / sizeof(float);
+    std::vector<float> records(count * floats);
+    for (size_t i = 0; i < records.size(); i += floats) {
+        records[i] = xs(rng);
+        records[i + 1] = ys(rng);
+        if (kind == RayQuery::ClosestHit) {
+            float angle = angles(rng);
+            records[i + 2] = std::cos(angle);
+            records[i + 3] = std::sin(angle);
+            records[i + 4] = reach;
+        }
+        else {
+            records[i + 2] = xs(rng);
+            records[i + 3] = ys(rng);
+        }
+    }
+    return records;
+}
+
+// Sends batches of random queries over the scene to a --serve-queries
+// server, several in flight at once, and compares throughput and results
+// with answering the same batches in-process. The server must have been
+// started with the same scene options.
+int runQueryBenchmark(const char* host, int port) {
+    const uint32_t batchSize = 4096;
+    const int batches = 100;
+    const int inFlight = 8;
+    RayQueryClient client;
+    if (!client.connect(host, port)) {
+        SDL_Log("query benchmark: cannot connect to %s:%d", host, port);
+        return 1;
+    }
+    ThreadPool pool;
+    bool matched = true;
+    for (uint32_t kind : { RayQuery::ClosestHit, RayQuery::Visible }) {
+        size_t floats = RayQuery::recordSize(kind) / sizeof(float);
+        std::vector<float> records = randomQueries(kind, batches * batchSize);
+        auto batch = [&](int b) { return reinterpret_cast<const uint8_t*>(&records[b * batchSize * floats]); };
+
+        size_t resultBytes = RayQuery::resultSize(kind, batchSize);
+        std::vector<uint8_t> expected(batches * resultBytes);
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int b = 0; b < batches; ++b) RayQuery::answer(pool, scene, kind, batchSize, batch(b), &expected[b * resultBytes]);
+        double localMs = millisecondsSince(start);
+
+        std::vector<uint8_t> results;
+        int sent = 0;
+        start = SDL_GetPerformanceCounter();
+        for (int b = 0; b < batches; ++b) {
+            while (sent < batches && sent < b + inFlight) {
+                client.send(static_cast<uint32_t>(sent), kind, reinterpret_cast<const float*>(batch(sent)), batchSize);
+                ++sent;
+            }
+            uint32_t id;
+            if (!client.receive(id, results)) {
+                SDL_Log("query benchmark: connection lost");
+                return 1;
+            }
+            if (id != static_cast<uint32_t>(b) || std::memcmp(results.data(), &expected[b * resultBytes], resultBytes) != 0) matched = false;
+        }
+        double remoteMs = millisecondsSince(start);
+
+        // Round trip of a small request with nothing else in flight.
+        const int trips = 50;
+        start = SDL_GetPerformanceCounter();
+        for (int t = 0; t < trips; ++t) {
+            uint32_t id;
+            client.send(0, kind, reinterpret_cast<const float*>(batch(0)), 64);
+            client.receive(id, results);
+        }
+        double tripMs = millisecondsSince(start) / trips;
+
+        double queries = static_cast<double>(batches) * batchSize;
+        SDL_Log("%s: in-process %.2f Mqueries/s, service %.2f Mqueries/s with %d batches of %u in flight, %.3f ms round trip for 64",
+            kind == RayQuery::ClosestHit ? "closest hit" : "visibility",
+            queries / localMs / 1000.0, queries / remoteMs / 1000.0, inFlight, batchSize, tripMs);
+    }
+    SDL_Log(matched ? "query benchmark: service results match in-process results"
+                    : "query benchmark: service results differ from in-process results");
+    return matched ? 0 : 1;
+}
+
+const char* const defaultSharedQueries = "srt-queries";
+
+// Like runQueryServer, but through a shared memory ring (see
+// SharedQueryServer) for producers on the same machine.
+int runSharedQueryServer(const char* name) {
+    ThreadPool pool;
+    SharedQueryServer server(scene, pool);
+    if (!server.create(name)) {
+        SDL_Log("query server: cannot create shared memory '%s'; is another server using it?", name);
+        return 1;
+    }
+    SDL_Log("query server: %d circles, %d threads, shared memory '%s'",
+        static_cast<int>(scene.circles.size()), pool.size(), name);
+    for (;;) server.poll(1000);
+}
+
+// runQueryBenchmark against a --serve-shared-queries server: each batch is
+// generated straight into its ring slot and checked where it is answered.
+int runSharedQueryBenchmark(const char* name) {
+    const uint32_t batchSize = 4096;
+    const int batches = 100;
+    SharedQueryClient client;
+    if (!client.open(name)) {
+        SDL_Log("query benchmark: no query server on shared memory '%s', or its header is malformed", name);
+        return 1;
+    }
+    if (client.capacity() < batchSize) {
+        SDL_Log("query benchmark: slots hold %u queries, need %u", client.capacity(), batchSize);
+        return 1;
+    }
+    ThreadPool pool;
+    bool matched = client.circleCount() == scene.circles.size()
+        && std::memcmp(client.circles(), scene.circles.data(), scene.circles.size() * sizeof(Circle)) == 0;
+    for (uint32_t kind : { RayQuery::ClosestHit, RayQuery::Visible }) {
+        size_t recordBytes = batchSize * RayQuery::recordSize(kind);
+        std::vector<float> records = randomQueries(kind, batches * batchSize);
+        auto batch = [&](int b) { return reinterpret_cast<const uint8_t*>(records.data()) + b * recordBytes; };
+
+        size_t resultBytes = RayQuery::resultSize(kind, batchSize);
+        std::vector<uint8_t> expected(batches * resultBytes);
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int b = 0; b < batches; ++b) RayQuery::answer(pool, scene, kind, batchSize, batch(b), &expected[b * resultBytes]);
+        double localMs = millisecondsSince(start);
+
+        // The memcpy stands in for a producer writing its rays in place.
+        std::vector<uint32_t> tickets(batches);
+        int submitted = 0;
+        int inFlight = static_cast<int>(client.slotCount());
+        start = SDL_GetPerformanceCounter();
+        for (int b = 0; b < batches; ++b) {
+            while (submitted < batches && submitted < b + inFlight) {
+                float* slot = client.nextRecords(5000);
+                if (!slot) break;
+                std::memcpy(slot, batch(submitted), recordBytes);
+                tickets[submitted] = client.submit(kind, batchSize);
+                ++submitted;
+            }
+            const uint8_t* results = b < submitted ? client.results(tickets[b], 5000) : nullptr;
+            if (!results) {
+                SDL_Log("query benchmark: server stopped answering");
+                return 1;
+            }
+            if (std::memcmp(results, &expected[b * resultBytes], resultBytes) != 0) matched = false;
+        }
+        double sharedMs = millisecondsSince(start);
+
+        const int trips = 200;
+        start = SDL_GetPerformanceCounter();
+        for (int t = 0; t < trips; ++t) {
+            std::memcpy(client.nextRecords(5000), batch(0), 64 * RayQuery::recordSize(kind));
+            client.results(client.submit(kind, 64), 5000);
+        }
+        double tripMs = millisecondsSince(start) / trips;
+
+        double queries = static_cast<double>(batches) * batchSize;
+        SDL_Log("%s: in-process %.2f Mqueries/s, shared memory %.2f Mqueries/s with %d batches of %u in flight, %.3f ms round trip for 64",
+            kind == RayQuery::ClosestHit ? "closest hit" : "visibility",
+            queries / localMs / 1000.0, queries / sharedMs / 1000.0, inFlight, batchSize, tripMs);
+    }
+    SDL_Log(matched ? "query benchmark: shared memory scene and results match in-process ones"
+                    : "query benchmark: shared memory scene or results differ from in-process ones");
+    return matched ? 0 : 1;
+}
+
+const int defaultFarmPort = 9755;
+
+bool writePpm(const std::string& path, const std::vector<uint32_t>& pixels, int width, int height) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+    std::fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<uint8_t> row(static_cast<size_t>(width) * 3);
+    bool ok = true;
+    for (int y = 0; y < height && ok; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint32_t p = pixels[static_cast<size_t>(y) * width + x];
+            row[x * 3] = static_cast<uint8_t>(p >> 16);
+            row[x * 3 + 1] = static_cast<uint8_t>(p >> 8);
+            row[x * 3 + 2] = static_cast<uint8_t>(p);
+        }
+        ok = std::fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+    return std::fclose(file) == 0 && ok;
+}
+
+// Renders frames frames of the headless light sweep at width x height on
+// --render-worker processes (see RenderCoordinator) and writes each as
+// <prefix>NNNN.ppm as soon as its last tile is in.
+int runRenderCoordinator(const char* address, int port, const RenderFarm::Job& job, int frames, int workers,
+    const std::string& prefix) {
+    RenderCoordinator coordinator(job, frames, static_cast<uint32_t>(scene.circles.size()),
+        static_cast<uint32_t>(scene.lights.size()));
+    if (!coordinator.listen(address, port)) {
+        SDL_Log("render farm: cannot listen on %s:%d", address, port);
+        return 1;
+    }
+    SDL_Log("render farm: %d frames of %dx%d in %d tiles each, waiting for %d workers on %s:%d",
+        frames, job.width, job.height, job.tilesPerFrame(), workers, address, port);
+
+    bool written = true;
+    Uint64 start = 0;
+    coordinator.run(workers, [&](int frame, const std::vector<uint32_t>& pixels) {
+        char name[16];
+        std::snprintf(name, sizeof(name), "%04d.ppm", frame);
+        if (!writePpm(prefix + name, pixels, job.width, job.height)) {
+            SDL_Log("render farm: cannot write %s%s", prefix.c_str(), name);
+            written = false;
+        }
+    }, [&] { start = SDL_GetPerformanceCounter(); });
+
+    double seconds = millisecondsSince(start) / 1000.0;
+    SDL_Log("render farm: %d frames in %.2f s, %.2f frames/s", frames, seconds, frames / seconds);
+    const std::vector<RenderCoordinator::WorkerStats>& stats = coordinator.getStats();
+    for (size_t i = 0; i < stats.size(); ++i) {
+        SDL_Log("render farm: worker %d rendered %d tiles, %d of them stolen", static_cast<int>(i), stats[i].rendered, stats[i].stolen);
+    }
+    return written ? 0 : 1;
+}
+
+// Renders tiles for a --render-farm coordinator until it is done. Tiles
+// are rendered with the headless settings and a full re-trace every frame,
+// so a tile comes out the same whichever worker renders it and in
+// whatever order; lights and the overlay are culled to the tile's view.
+int runRenderWorker(const char* host, int port) {
+    RenderWorker worker;
+    if (!worker.connect(host, port, static_cast<uint32_t>(scene.circles.size()), static_cast<uint32_t>(scene.lights.size()))) {
+        SDL_Log("render worker: no coordinator at %s:%d, or it has a different scene or sent an invalid job", host, port);
+        return 1;
+    }
+    accumulationFrames = 1;
+    const RenderFarm::Job& job = worker.getJob();
+    Camera imageCamera = camera.resized(job.width, job.height);
+    lod.pixelsPerUnit = imageCamera.zoom;
+    float markerRadius = 20.0f * imageCamera.zoom / camera.zoom;
+
+    ThreadPool pool;
+    TiledFramebuffer framebuffer;
+    std::vector<uint32_t> pixels;
+    std::vector<LightState> lightStates = makeLightStates(scene);
+    std::vector<CircleShape> occluders;
+    int tiles = 0;
+    uint32_t task;
+    while (worker.nextTask(task)) {
+        int frame, x, y, w, h;
+        job.tileRect(task, frame, x, y, w, h);
+        FrameArena::beginFrame();
+        if (w != framebuffer.getWidth() || h != framebuffer.getHeight()) framebuffer.resize(w, h);
+        Camera tileCamera = imageCamera.cropped(x, y, w, h);
+        scene.lights[0].position = sweptLightPosition(frame);
+
+        LightFrame* lightFrames = FrameArena::forThisThread().allocArray<LightFrame>(scene.lights.size());
+        int lightCount = traceFrame(pool, scene, lightStates, tileCamera, 360, lightFrames);
+        OverlayFrame overlay = collectOverlay(scene, tileCamera, lightFrames, lightCount, markerRadius, 1.0f, occluders);
+        renderFrame(pool, framebuffer, tileCamera, lightFrames, lightCount, true, &overlay);
+
+        pixels.resize(static_cast<size_t>(w) * h);
+        copyToLinear(pool, framebuffer, pixels.data(), w * 4);
+        if (!worker.sendTile(task, pixels.data(), w, h)) break;
+        ++tiles;
+    }
+    SDL_Log("render worker: rendered %d tiles", tiles);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool sdlLines = false;
+    bool benchFramebuffer = false;
+    bool benchLines = false;
+    bool benchShapes = false;
+    bool benchSdlDraw = false;
+    bool benchPresent = false;
+    bool benchOccupancy = false;
+    bool benchRaySort = false;
+    bool benchWideBvh = false;
+    bool benchCompressedBvh = false;
+    bool benchAcceleratorCache = false;
+    bool benchBvhBuild = false;
+    bool softwarePresent = false;
+    bool streamFrames = false;
+    bool viewStream = false;
+    bool serveQueries = false;
+    bool benchQueries = false;
+    bool serveSharedQueries = false;
+    bool benchSharedQueries = false;
+    const char* sharedQueries = defaultSharedQueries;
+    bool renderFarm = false;
+    bool renderWorker = false;
+    RenderFarm::Job farmJob;
+    const int maxFarmWorkers = RenderCoordinator::MaxWorkers;
+    int farmFrames = 1;
+    int farmWorkers = 1;
+    std::string farmOutput = "frame";
+    std::string streamHost;
+    int streamPort = defaultStreamPort;
+    int headlessFrames = 0;
+    int randomCircles = 0;
+    int randomLights = 1;
+    BvhBuilder bvhBuilder = BvhBuilder::Lbvh;
+    const char* acceleratorCache = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--headless") == 0) {
+            headlessFrames = i + 1 < argc && std::atoi(argv[i + 1]) > 0 ? std::atoi(argv[++i]) : 600;
+        }
+        else if (std::strcmp(argv[i], "--bench-framebuffer") == 0) {
+            benchFramebuffer = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-lines") == 0) {
+            benchLines = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-shapes") == 0) {
+            benchShapes = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-sdl-draw") == 0) {
+            benchSdlDraw = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-present") == 0) {
+            benchPresent = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-occupancy") == 0) {
+            benchOccupancy = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-ray-sort") == 0) {
+            benchRaySort = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-wide-bvh") == 0) {
+            benchWideBvh = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-compressed-bvh") == 0) {
+            benchCompressedBvh = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-accel-cache") == 0) {
+            benchAcceleratorCache = true;
+        }
+        else if (std::strcmp(argv[i], "--bench-bvh-build") == 0) {
+            benchBvhBuild = true;
+        }
+        else if (std::strcmp(argv[i], "--software-present") == 0) {
+            softwarePresent = true;
+        }
+        else if (std::strcmp(argv[i], "--stream-frames") == 0) {
+            streamFrames = true;
+            streamHost = "127.0.0.1";
+            if (i + 1 < argc && argv[i + 1][0] != '-') parseEndpoint(argv[++i], streamHost, streamPort);
+        }
+        else if (std::strcmp(argv[i], "--serve-queries") == 0 || std::strcmp(argv[i], "--bench-queries") == 0) {
+            bool serve = argv[i][2] == 's';
+            (serve ? serveQueries : benchQueries) = true;
+            streamHost = serve ? "127.0.0.1" : "localhost";
+            streamPort = defaultQueryPort;
+            if (i + 1 < argc && argv[i + 1][0] != '-') parseEndpoint(argv[++i], streamHost, streamPort);
+        }
+        else if (std::strcmp(argv[i], "--serve-shared-queries") == 0 || std::strcmp(argv[i], "--bench-shared-queries") == 0) {
+            (argv[i][2] == 's' ? serveSharedQueries : benchSharedQueries) = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-') sharedQueries = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--render-farm") == 0 && i + 3 < argc) {
+            renderFarm = true;
+            farmJob.width = std::min(std::max(1, std::atoi(argv[++i])), RenderFarm::MaxSize);
+            farmJob.height = std::min(std::max(1, std::atoi(argv[++i])), RenderFarm::MaxSize);
+            farmFrames = std::max(1, std::atoi(argv[++i]));
+            streamHost = "127.0.0.1";
+            streamPort = defaultFarmPort;
+            if (i + 1 < argc && argv[i + 1][0] != '-') parseEndpoint(argv[++i], streamHost, streamPort);
+        }
+        else if (std::strcmp(argv[i], "--render-worker") == 0) {
+            renderWorker = true;
+            streamHost = "localhost";
+            streamPort = defaultFarmPort;
+            if (i + 1 < argc && argv[i + 1][0] != '-') parseEndpoint(argv[++i], streamHost, streamPort);
+        }
+        else if (std::strcmp(argv[i], "--farm-workers") == 0 && i + 1 < argc) {
+            farmWorkers = std::min(std::max(1, std::atoi(argv[++i])), maxFarmWorkers);
+        }
+        else if (std::strcmp(argv[i], "--farm-tile") == 0 && i + 1 < argc) {
+            farmJob.tileSize = std::min(std::max(8, std::atoi(argv[++i])), RenderFarm::MaxSize);
+        }
+        else if (std::strcmp(argv[i], "--farm-output") == 0 && i + 1 < argc) {
+            farmOutput = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--view") == 0 && i + 1 < argc) {
+            viewStream = true;
+            streamHost = "localhost";
+            parseEndpoint(argv[++i], streamHost, streamPort);
+        }
+        else if (std::strcmp(argv[i], "--sdl-lines") == 0) {
+            sdlLines = true;
+        }
+        else if (std::strcmp(argv[i], "--antialias-rays") == 0) {
+            antialiasRays = true;
+        }
+        else if (std::strcmp(argv[i], "--render-scale") == 0 && i + 1 < argc) {
+            float scale = static_cast<float>(std::atof(argv[++i]));
+            renderScale = scale > 0.05f ? std::min(scale, 1.0f) : 1.0f;
+        }
+        else if (std::strcmp(argv[i], "--target-ms") == 0 && i + 1 < argc) {
+            targetFrameMs = std::max(0.0, std::atof(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--accumulate") == 0 && i + 1 < argc) {
+            accumulationFrames = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--lod-error") == 0 && i + 1 < argc) {
+            lod.maxErrorPixels = static_cast<float>(std::atof(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--random-scene") == 0 && i + 2 < argc) {
+            randomCircles = std::max(0, std::atoi(argv[i + 1]));
+            randomLights = std::max(1, std::atoi(argv[i + 2]));
+            i += 2;
+        }
+        else if (std::strcmp(argv[i], "--bvh-builder") == 0 && i + 1 < argc) {
+            ++i;
+            if (std::strcmp(argv[i], "median") == 0) bvhBuilder = BvhBuilder::Median;
+            else if (std::strcmp(argv[i], "sah") == 0) bvhBuilder = BvhBuilder::BinnedSah;
+            else bvhBuilder = BvhBuilder::Lbvh;
+        }
+        else if (std::strcmp(argv[i], "--accel-cache") == 0 && i + 1 < argc) {
+            acceleratorCache = argv[++i];
+        }
+    }
+
+    if (randomCircles > 0) {
+        // The world grows with the circle count so density stays the same;
+        // the camera starts zoomed out over all of it.
+        float scale = std::max(1.0f, std::sqrt(randomCircles / 2000.0f));
+        ThreadPool buildPool;
+        AcceleratorCache cache(acceleratorCache ? acceleratorCache : "");
+        Uint64 start = SDL_GetPerformanceCounter();
+        scene = Scene::scatterRandom(randomCircles, randomLights, 800 * scale, 600 * scale);
+        double generateMs = millisecondsSince(start);
+        start = SDL_GetPerformanceCounter();
+        AcceleratorCache::Result result = scene.rebuild(bvhBuilder, &buildPool, acceleratorCache ? &cache : nullptr);
+        SDL_Log("random scene: %d circles, generated in %.1f ms, accelerators %s in %.1f ms", randomCircles, generateMs,
+            result == AcceleratorCache::Result::Loaded ? "loaded from the cache" : "built", millisecondsSince(start));
+        if (acceleratorCache && result == AcceleratorCache::Result::NotSaved) {
+            SDL_Log("could not save the accelerators to %s", acceleratorCache);
+        }
+        camera.frame(Aabb(Vec2(0, 0), Vec2(800 * scale, 600 * scale)));
+    }
+    else if (bvhBuilder != BvhBuilder::Lbvh) {
+        scene.rebuild(bvhBuilder);
+    }
+
+    if (benchFramebuffer) return runFramebufferBenchmark();
+    if (benchLines) return runLineBenchmark();
+    if (benchShapes) return runShapeBenchmark();
+    if (benchSdlDraw) return runSdlDrawBenchmark();
+    if (benchPresent) return runPresentBenchmark();
+    if (benchOccupancy) return runOccupancyBenchmark();
+    if (benchRaySort) return runRaySortBenchmark();
+    if (benchWideBvh) return runWideBvhBenchmark();
+    if (benchCompressedBvh) return runCompressedBvhBenchmark();
+    if (benchAcceleratorCache) return runAcceleratorCacheBenchmark(acceleratorCache ? acceleratorCache : ".");
+    if (benchBvhBuild) return runBvhBuildBenchmark();
+    if (headlessFrames > 0) return runHeadless(headlessFrames);
+    if (streamFrames) return runFrameServer(streamHost.c_str(), streamPort);
+    if (viewStream) return runFrameViewer(streamHost.c_str(), streamPort);
+    if (serveQueries) return runQueryServer(streamHost.c_str(), streamPort);
+    if (benchQueries) return runQueryBenchmark(streamHost.c_str(), streamPort);
+    if (serveSharedQueries) return runSharedQueryServer(sharedQueries);
+    if (benchSharedQueries) return runSharedQueryBenchmark(sharedQueries);
+    if (renderFarm) return runRenderCoordinator(streamHost.c_str(), streamPort, farmJob, farmFrames, farmWorkers, farmOutput);
+    if (renderWorker) return runRenderWorker(streamHost.c_str(), streamPort);
+
+    SDL_Init(SDL_INIT_VIDEO);
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+
+    SDL_Window* window = SDL_CreateWindow("Interactive Raytracer",
+        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+        800, 600, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
+
+    // Without a GPU there is often no accelerated renderer; the window
+    // surface then presents the framebuffer with no texture in between.
+    // --software-present takes that path even when a renderer exists, for
+    // VMs where it would be an emulated one.
+    SDL_Renderer* renderer = nullptr;
+    if (!softwarePresent) {
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
+        if (!renderer) SDL_Log("no accelerated renderer (%s), presenting through the window surface", SDL_GetError());
+    }
+    if (!renderer) {
+        SDL_SetHint(SDL_HINT_FRAMEBUFFER_ACCELERATION, "0");
+        if (sdlLines) SDL_Log("--sdl-lines needs a renderer, drawing into the framebuffer instead");
+        sdlLines = false;
+    }
+    else {
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    }
+    Uint32 textureFormat = renderer ? streamingFormat(renderer) : static_cast<Uint32>(SDL_PIXELFORMAT_ARGB8888);
+
+    // On high-DPI displays the renderer has more pixels than the window has
+    // points; the camera works in pixels, so the same world area stays in
+    // view at a higher zoom.
+    float pixelsPerPoint = outputScale(window, renderer);
+    camera.screenSize = camera.screenSize * pixelsPerPoint;
+    camera.zoom *= pixelsPerPoint;
+
+    ThreadPool pool;
+    TiledFramebuffer framebuffer;
+    std::vector<LightState> lightStates = makeLightStates(scene);
+    std::vector<CircleShape> occluders;
+    SdlBatch sdlBatch;
+    SDL_Texture* texture = nullptr;
+    SDL_Surface* staging = nullptr;
+    // Interactive sessions adapt by default; the render scale given on the
+    // command line becomes the upper limit.
+    QualityController quality(targetFrameMs >= 0 ? targetFrameMs : 8.0, renderScale);
+
+    bool running = true;
+#ifdef SRT_PROFILE
+    int frameIndex = 0;
+#endif
+
+    while (running) {
+        Uint64 frameStart = SDL_GetPerformanceCounter();
+        FrameArena::beginFrame();
+        AllocationTracker::setStage(FrameStage::Events);
+        FrameArena& arena = FrameArena::forThisThread();
+
+        SDL_Event event;
+
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT) running = false;
+
+            if (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+                pixelsPerPoint = outputScale(window, renderer);
+            }
+
+            InputEvent input;
+            if (toInputEvent(event, pixelsPerPoint, input)) applyInput(input, 20 * pixelsPerPoint);
+        }
+
+        // The window may have been resized since the last frame; the
+        // framebuffer and its texture follow only when a frame is drawn.
+        int outputWidth, outputHeight;
+        outputSize(window, renderer, outputWidth, outputHeight);
+        camera.screenSize = Vec2(static_cast<float>(outputWidth), static_cast<float>(outputHeight));
+        if (quality.enabled()) renderScale = quality.getRenderScale();
+        if (!sdlLines) {
+            ensureRenderTarget(renderer, textureFormat, framebuffer, texture, scaledSize(outputWidth), scaledSize(outputHeight));
+        }
+        Camera renderCamera = sdlLines ? camera : camera.resized(framebuffer.getWidth(), framebuffer.getHeight());
+
+        AllocationTracker::setStage(FrameStage::Trace);
+        const int numRays = quality.enabled() ? quality.getNumRays() : 360;
+        lod.pixelsPerUnit = renderCamera.zoom;
+        LightFrame* lightFrames = arena.allocArray<LightFrame>(scene.lights.size());
+        int lightCount = traceFrame(pool, scene, lightStates, renderCamera, numRays, lightFrames);
+
+        AllocationTracker::setStage(FrameStage::Draw);
+        // Markers keep their size in window points whatever the render scale.
+        float markerRadius = 20 * pixelsPerPoint * renderCamera.zoom / camera.zoom;
+        OverlayFrame overlay = collectOverlay(scene, renderCamera, lightFrames, lightCount, markerRadius, 1.0f, occluders);
+        if (sdlLines) {
+            SDL_SetRenderDrawColor(renderer, 30, 30, 30, 255);
+            SDL_RenderClear(renderer);
+            batchFrame(sdlBatch, lightFrames, lightCount, overlay);
+            sdlBatch.submit(renderer);
+        }
+        else {
+            renderFrame(pool, framebuffer, renderCamera, lightFrames, lightCount, true, &overlay);
+            if (renderer) {
+                presentFramebuffer(pool, framebuffer, texture);
+                SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+            }
+            else {
+                presentToSurface(pool, framebuffer, window, staging);
+            }
+        }
+
+        // Measured before presenting, which may block on vsync.
+        AllocationTracker::setStage(FrameStage::Present);
+        quality.addFrame(millisecondsSince(frameStart));
+        if (renderer) SDL_RenderPresent(renderer);
+
+#ifdef SRT_PROFILE
+        reportFrameAllocations(frameIndex++);
+#endif
+    }
+
+    if (texture) SDL_DestroyTexture(texture);
+    if (staging) SDL_FreeSurface(staging);
+    if (renderer) SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 0;
+}
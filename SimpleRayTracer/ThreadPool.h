@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads started once and reused every frame. Work is
+// handed out as indices from a shared counter; the calling thread takes part
+// too. parallelFor() does not allocate, so it is safe on the per-frame path.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threadCount = 0) {
+        if (threadCount <= 0) {
+            threadCount = static_cast<int>(std::thread::hardware_concurrency());
+            if (threadCount <= 0) threadCount = 1;
+        }
+        for (int i = 1; i < threadCount; ++i) {
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return static_cast<int>(workers.size()) + 1; }
+
+    template <typename Fn>
+    void parallelFor(int count, Fn&& fn) {
+        if (count <= 0) return;
+        if (count == 1 || workers.empty()) {
+            for (int i = 0; i < count; ++i) fn(i);
+            return;
+        }
+        run(count, [](void* context, int index) { (*static_cast<Fn*>(context))(index); }, &fn);
+    }
+
+private:
+    typedef void (*Invoke)(void*, int);
+
+    void run(int count, Invoke invoke, void* context) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobInvoke = invoke;
+            jobContext = context;
+            jobCount = count;
+            nextIndex.store(0, std::memory_order_relaxed);
+            busyWorkers = static_cast<int>(workers.size());
+            ++generation;
+        }
+        wake.notify_all();
+
+        drain();
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busyWorkers == 0; });
+    }
+
+    void drain() {
+        for (;;) {
+            int index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+            if (index >= jobCount) break;
+            jobInvoke(jobContext, index);
+        }
+    }
+
+    void workerLoop() {
+        uint64_t seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+
+            drain();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busyWorkers == 0) done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    bool stopping = false;
+
+    Invoke jobInvoke = nullptr;
+    void* jobContext = nullptr;
+    int jobCount = 0;
+    int busyWorkers = 0;
+    std::atomic<int> nextIndex{0};
+};
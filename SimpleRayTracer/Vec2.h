@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cmath>
+
+struct Vec2 {
+    float x, y;
+    Vec2(float x = 0, float y = 0) : x(x), y(y) {}
+
+    Vec2 operator+(const Vec2& v) const { return Vec2(x + v.x, y + v.y); }
+    Vec2 operator-(const Vec2& v) const { return Vec2(x - v.x, y - v.y); }
+    Vec2 operator*(float s) const { return Vec2(x * s, y * s); }
+
+    float length() const { return std::sqrt(x * x + y * y); }
+    Vec2 normalize() const {
+        float len = length();
+        return len > 0 ? Vec2(x / len, y / len) : *this;
+    }
+};
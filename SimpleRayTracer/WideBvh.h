@@ -0,0 +1,358 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "Bvh.h"
+#include "Geometry.h"
+
+#if !defined(SRT_SSE2) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SRT_SSE2 1
+#endif
+#ifdef SRT_SSE2
+#include <emmintrin.h>
+#endif
+
+// Four children's bounds side by side, one array per coordinate, so a ray
+// is slab-tested against all of them with one SSE operation per step.
+// Unused slots hold a point box at 1e30, which no ray reaches. 96 bytes.
+struct WideBvhNode {
+    float minX[4], minY[4], maxX[4], maxY[4];
+    // Inner children: node index and a count of zero. Leaves: first
+    // primitive and primitive count. Unused slots: a count of -1.
+    int32_t links[4];
+    int32_t counts[4];
+
+    void setBounds(const Aabb* bounds, int used) {
+        for (int s = 0; s < 4; ++s) {
+            bool set = s < used;
+            minX[s] = set ? bounds[s].min.x : 1e30f;
+            minY[s] = set ? bounds[s].min.y : 1e30f;
+            maxX[s] = set ? bounds[s].max.x : 1e30f;
+            maxY[s] = set ? bounds[s].max.y : 1e30f;
+            links[s] = 0;
+            counts[s] = -1;
+        }
+    }
+
+    void setChild(int slot, int32_t child, int32_t count) {
+        links[slot] = child;
+        counts[slot] = count;
+    }
+
+    int32_t child(int slot) const { return links[slot]; }
+    int32_t count(int slot) const { return counts[slot]; }
+
+    // Bitmask of the children whose bounds the ray enters within
+    // [0, tMax], with their entry distances.
+    int hit(const Vec2& origin, const Vec2& invDir, float tMax, float* tEntry) const {
+#ifdef SRT_SSE2
+        const __m128 ox = _mm_set1_ps(origin.x);
+        const __m128 oy = _mm_set1_ps(origin.y);
+        const __m128 ix = _mm_set1_ps(invDir.x);
+        const __m128 iy = _mm_set1_ps(invDir.y);
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minX), ox), ix);
+        __m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxX), ox), ix);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(minY), oy), iy);
+        __m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(maxY), oy), iy);
+        __m128 tNear = _mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2));
+        __m128 tFar = _mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2));
+        _mm_storeu_ps(tEntry, tNear);
+        __m128 entered = _mm_and_ps(_mm_cmpge_ps(tFar, _mm_max_ps(tNear, _mm_setzero_ps())),
+            _mm_cmple_ps(tNear, _mm_set1_ps(tMax)));
+        return _mm_movemask_ps(entered);
+#else
+        int mask = 0;
+        for (int c = 0; c < 4; ++c) {
+            Aabb box(Vec2(minX[c], minY[c]), Vec2(maxX[c], maxY[c]));
+            if (intersectAabb(box, origin, invDir, tMax, tEntry[c])) mask |= 1 << c;
+        }
+        return mask;
+#endif
+    }
+};
+
+// The same four children in half the space: their bounds as bytes on a
+// 255-step grid over the node's own bounds, rounded outwards, so a ray can
+// enter a child's box a little before it reaches the child but never miss
+// it. Links pack a leaf's first primitive and count into one word. 48
+// bytes.
+struct QuantizedWideBvhNode {
+    static const uint32_t Leaf = 0x80000000u;
+    static const uint32_t Unused = 0xffffffffu;
+    static_assert(Bvh::maxLeafSize < 8, "leaf counts are packed in three bits");
+
+    // A child's min x is originX + minX * scaleX, and so on.
+    float originX, originY, scaleX, scaleY;
+    uint8_t minX[4], minY[4], maxX[4], maxY[4];
+    // Inner children: node index. Leaves: Leaf | first << 3 | count.
+    uint32_t links[4];
+
+    void setBounds(const Aabb* bounds, int used) {
+        Aabb all;
+        for (int s = 0; s < used; ++s) all.grow(bounds[s]);
+        originX = all.min.x;
+        originY = all.min.y;
+        scaleX = gridStep(all.min.x, all.max.x);
+        scaleY = gridStep(all.min.y, all.max.y);
+        for (int s = 0; s < 4; ++s) {
+            links[s] = Unused;
+            if (s >= used) {
+                minX[s] = minY[s] = maxX[s] = maxY[s] = 0;
+                continue;
+            }
+            minX[s] = below(originX, scaleX, bounds[s].min.x);
+            minY[s] = below(originY, scaleY, bounds[s].min.y);
+            maxX[s] = above(originX, scaleX, bounds[s].max.x);
+            maxY[s] = above(originY, scaleY, bounds[s].max.y);
+        }
+    }
+
+    void setChild(int slot, int32_t child, int32_t count) {
+        links[slot] = count > 0 ? Leaf | static_cast<uint32_t>(child) << 3 | static_cast<uint32_t>(count) : static_cast<uint32_t>(child);
+    }
+
+    int32_t child(int slot) const {
+        return static_cast<int32_t>(links[slot] & Leaf ? (links[slot] & ~Leaf) >> 3 : links[slot]);
+    }
+
+    int32_t count(int slot) const {
+        if (links[slot] == Unused) return -1;
+        return links[slot] & Leaf ? static_cast<int32_t>(links[slot] & 7) : 0;
+    }
+
+    int hit(const Vec2& origin, const Vec2& invDir, float tMax, float* tEntry) const {
+#ifdef SRT_SSE2
+        // Bytes to floats: minX, minY, maxX, maxY, four lanes each.
+        __m128i bytes;
+        std::memcpy(&bytes, minX, sizeof(bytes));
+        const __m128i zero = _mm_setzero_si128();
+        __m128i low = _mm_unpacklo_epi8(bytes, zero);
+        __m128i high = _mm_unpackhi_epi8(bytes, zero);
+        const __m128 sx = _mm_set1_ps(scaleX);
+        const __m128 sy = _mm_set1_ps(scaleY);
+        // Origin-relative, so the node's origin folds into the ray's.
+        const __m128 ox = _mm_set1_ps(origin.x - originX);
+        const __m128 oy = _mm_set1_ps(origin.y - originY);
+        const __m128 ix = _mm_set1_ps(invDir.x);
+        const __m128 iy = _mm_set1_ps(invDir.y);
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), sx), ox), ix);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), sy), oy), iy);
+        __m128 tx2 = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), sx), ox), ix);
+        __m128 ty2 = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), sy), oy), iy);
+        __m128 tNear = _mm_max_ps(_mm_min_ps(tx1, tx2), _mm_min_ps(ty1, ty2));
+        __m128 tFar = _mm_min_ps(_mm_max_ps(tx1, tx2), _mm_max_ps(ty1, ty2));
+        _mm_storeu_ps(tEntry, tNear);
+        __m128 entered = _mm_and_ps(_mm_cmpge_ps(tFar, _mm_max_ps(tNear, _mm_setzero_ps())),
+            _mm_cmple_ps(tNear, _mm_set1_ps(tMax)));
+        __m128i links4;
+        std::memcpy(&links4, links, sizeof(links4));
+        __m128 used = _mm_castsi128_ps(_mm_cmpeq_epi32(links4, _mm_set1_epi32(-1)));
+        return _mm_movemask_ps(_mm_andnot_ps(used, entered));
+#else
+        int mask = 0;
+        for (int c = 0; c < 4; ++c) {
+            if (links[c] == Unused) continue;
+            Aabb box(Vec2(originX + minX[c] * scaleX, originY + minY[c] * scaleY),
+                Vec2(originX + maxX[c] * scaleX, originY + maxY[c] * scaleY));
+            if (intersectAabb(box, origin, invDir, tMax, tEntry[c])) mask |= 1 << c;
+        }
+        return mask;
+#endif
+    }
+
+private:
+    // Smallest step whose 255th multiple reaches from lo to hi in float.
+    static float gridStep(float lo, float hi) {
+        float step = (hi - lo) / 255.0f;
+        while (lo + 255.0f * step < hi) step = std::nextafter(step, 1e30f);
+        return step;
+    }
+
+    // Largest q with origin + q * step at or below v, smallest at or above.
+    static uint8_t below(float origin, float step, float v) {
+        int q = step > 0 ? std::min(std::max(static_cast<int>((v - origin) / step), 0), 255) : 0;
+        while (q > 0 && origin + q * step > v) --q;
+        return static_cast<uint8_t>(q);
+    }
+
+    static uint8_t above(float origin, float step, float v) {
+        int q = step > 0 ? std::min(std::max(static_cast<int>(std::ceil((v - origin) / step)), 0), 255) : 0;
+        while (q < 255 && origin + q * step < v) ++q;
+        return static_cast<uint8_t>(q);
+    }
+};
+
+// The binary BVH collapsed to four children per node: each node takes its
+// binary node's two children and keeps replacing the inner one with the
+// largest bounds by its own two children until it has four. Half the levels
+// and a quarter of the nodes remain, and a ray visits each with one
+// four-wide box test, nearest child first. Node is WideBvhNode, or
+// QuantizedWideBvhNode for half the node memory.
+//
+// Each slot keeps the proxy of the binary node it came from, 64 bytes a
+// node alongside it, so with proxies a node takes 160 or 112 bytes. The levels
+// collapsed away lose theirs, so with LOD a ray may go a level or two deeper
+// than in the binary tree before a proxy is accepted, never less deep.
+template <typename Node>
+class WideBvhOf {
+public:
+    static const int Width = 4;
+    // A wide tree is no deeper than the binary tree it is collapsed from,
+    // and a node at depth d leaves at most 3d + 4 entries on the traversal
+    // stack once its inner children are pushed.
+    static const int StackSize = 3 * Bvh::MaxDepth + 4;
+
+    void build(const Bvh& bvh) {
+        primitives = bvh.getPrimitives();
+        nodes.clear();
+        proxies.clear();
+        if (primitives.empty()) return;
+        const std::vector<BvhNode>& binary = bvh.getNodes();
+        nodes.reserve(binary.size() / 2 + 1);
+        collapse(bvh, 0);
+    }
+
+    bool empty() const { return primitives.empty(); }
+    const std::vector<Node>& getNodes() const { return nodes; }
+
+    // As Bvh::depth().
+    int depth() const {
+        if (nodes.empty()) return 0;
+        int deepest = 0;
+        std::vector<std::pair<int, int>> todo(1, std::make_pair(0, 0));
+        while (!todo.empty()) {
+            std::pair<int, int> next = todo.back();
+            todo.pop_back();
+            deepest = std::max(deepest, next.second);
+            for (int s = 0; s < Width; ++s) {
+                if (nodes[next.first].count(s) == 0) todo.push_back(std::make_pair(nodes[next.first].child(s), next.second + 1));
+            }
+        }
+        return deepest;
+    }
+    // The nodes and their slots' LOD proxies, which traversal reads with
+    // them.
+    size_t nodeBytes() const { return nodes.size() * sizeof(Node) + proxies.size() * sizeof(BvhProxy); }
+
+    // Same as Bvh::intersect.
+    bool intersect(const Vec2& origin, const Vec2& dir, float tMax, float& tHit,
+        const LodSettings* lod = nullptr) const {
+        if (primitives.empty()) return false;
+        Vec2 invDir(1.0f / dir.x, 1.0f / dir.y);
+        int stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+        bool hit = false;
+        tHit = tMax;
+
+        while (top > 0) {
+            int index = stack[--top];
+            const Node& node = nodes[index];
+            float tEntry[Width];
+            int mask = node.hit(origin, invDir, tHit, tEntry);
+            if (mask == 0) continue;
+
+            // Hit children by entry distance, insertion sorted.
+            int order[Width];
+            int hits = 0;
+            for (int c = 0; c < Width; ++c) {
+                if (!(mask >> c & 1)) continue;
+                int k = hits++;
+                for (; k > 0 && tEntry[order[k - 1]] > tEntry[c]; --k) order[k] = order[k - 1];
+                order[k] = c;
+            }
+
+            // Proxies and leaves are tested straight away, nearest first, so
+            // tHit has shrunk before the inner children are pushed.
+            int inner[Width];
+            int innerCount = 0;
+            for (int k = 0; k < hits; ++k) {
+                int c = order[k];
+                if (tEntry[c] > tHit) break;
+                int count = node.count(c);
+                if (lod && count != 1 && lod->accepts(proxies[index * Width + c])) {
+                    float t;
+                    if (intersectCircle(proxies[index * Width + c].shape, origin, dir, t) && t < tHit) {
+                        tHit = t;
+                        hit = true;
+                    }
+                }
+                else if (count > 0) {
+                    int first = node.child(c);
+                    for (int i = first; i < first + count; ++i) {
+                        float t;
+                        if (intersectCircle(primitives[i], origin, dir, t) && t < tHit) {
+                            tHit = t;
+                            hit = true;
+                        }
+                    }
+                }
+                else {
+                    inner[innerCount++] = c;
+                }
+            }
+            // Farthest pushed first so the nearest is visited next.
+            for (int k = innerCount - 1; k >= 0; --k) {
+                if (tEntry[inner[k]] <= tHit) stack[top++] = node.child(inner[k]);
+            }
+        }
+        return hit;
+    }
+
+private:
+    friend class AcceleratorCache;
+
+    // Builds the wide node for binary node index and everything below it;
+    // returns its index.
+    int collapse(const Bvh& bvh, int index) {
+        const std::vector<BvhNode>& binary = bvh.getNodes();
+        int slots[Width];
+        int used = 0;
+        if (binary[index].isLeaf()) {
+            slots[used++] = index;
+        }
+        else {
+            slots[used++] = binary[index].first;
+            slots[used++] = binary[index].first + 1;
+        }
+        while (used < Width) {
+            int widest = -1;
+            for (int s = 0; s < used; ++s) {
+                const BvhNode& candidate = binary[slots[s]];
+                if (!candidate.isLeaf() && (widest < 0 || candidate.bounds.perimeter() > binary[slots[widest]].bounds.perimeter())) widest = s;
+            }
+            if (widest < 0) break;
+            int first = binary[slots[widest]].first;
+            slots[widest] = first;
+            slots[used++] = first + 1;
+        }
+
+        int wide = static_cast<int>(nodes.size());
+        nodes.push_back(Node());
+        proxies.resize(nodes.size() * Width);
+        Aabb bounds[Width];
+        for (int s = 0; s < used; ++s) bounds[s] = binary[slots[s]].bounds;
+        nodes[wide].setBounds(bounds, used);
+        for (int s = 0; s < used; ++s) {
+            const BvhNode& source = binary[slots[s]];
+            proxies[wide * Width + s] = bvh.getProxies()[slots[s]];
+            // nodes may grow; index it again afterwards.
+            int child = source.isLeaf() ? source.first : collapse(bvh, slots[s]);
+            nodes[wide].setChild(s, child, source.isLeaf() ? source.count : 0);
+        }
+        return wide;
+    }
+
+    std::vector<Node> nodes;
+    // Width per node, the proxy of each slot.
+    std::vector<BvhProxy> proxies;
+    std::vector<Circle> primitives;
+};
+
+typedef WideBvhOf<WideBvhNode> WideBvh;
+typedef WideBvhOf<QuantizedWideBvhNode> QuantizedWideBvh;